@@ -0,0 +1,261 @@
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <learnopengl/camera.h>
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+
+#include <board.hpp>
+#include <cpu_profiler.hpp>
+#include <frame_arena.hpp>
+#include <frustum_culling.hpp>
+#include <lights.hpp>
+#include <scene.hpp>
+#include <shadows.hpp>
+#include <uniform_names.hpp>
+
+#include "mock_gl.hpp"
+
+// CPU microbenchmarks of the per-frame hot paths of the renderer, the GL calls
+// they make go to the mock in mock_gl.hpp, so no context or display is needed.
+// Every benchmark runs a fixed number of iterations per repeat, the first
+// repeat only warms up. Prints CSV, nanoseconds per iteration:
+//     benchmark,iterations,repeats,median_ns,min_ns,max_ns
+// Run from the repository root, the models and shaders are loaded from there.
+//   --repeats <n>       measured repeats of every benchmark, 15 by default
+//   --filter <text>     only the benchmarks whose name contains it
+
+// keeps the compiler from optimizing the value away or hoisting its computation
+template<typename T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template<typename Body>
+void run(const char *name, unsigned int iterations, unsigned int repeats, const std::string &filter, Body body) {
+    if (std::strstr(name, filter.c_str()) == nullptr)
+        return;
+    vector <double> samples;
+    for (unsigned int repeat = 0; repeat <= repeats; repeat++) {
+        uint64_t start = CpuProfiler::now();
+        for (unsigned int i = 0; i < iterations; i++)
+            body(i);
+        uint64_t end = CpuProfiler::now();
+        if (repeat > 0)
+            samples.push_back((double) (end - start) / (double) iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+    std::cout << fmt::format("{},{},{},{:.2f},{:.2f},{:.2f}", name, iterations, repeats,
+                             samples[samples.size() / 2], samples.front(), samples.back()) << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int repeats = 15;
+    std::string filter;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--repeats") == 0 and i + 1 < argc)
+            repeats = (unsigned int) std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--filter") == 0 and i + 1 < argc)
+            filter = argv[++i];
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc) mock_gl_loader)) {
+        std::cout << "Failed to initialize the mock GL" << std::endl;
+        return -1;
+    }
+
+    // the scene of a game's start: the board and its 32 pieces
+    // --------------------------------------------------------
+    Model boardModel("resources/objects/stone_board/model.obj");
+    std::map<string, std::unique_ptr<Model>> pieceModels;
+    Board board;
+    Scene scene;
+    scene.add(&boardModel, glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.06f)), glm::vec3(0.183f)));
+    for (int row = 1; row <= 8; row++) {
+        for (char col = 'a'; col <= 'h'; col++) {
+            string piece = board.get_piece(row, col);
+            if (piece.empty())
+                continue;
+            std::unique_ptr<Model> &model = pieceModels[piece];
+            if (!model)
+                model = std::make_unique<Model>("resources/objects/stone_chess/" + piece + "/modelf.obj");
+            glm::mat4 transform = glm::scale(glm::translate(glm::mat4(1.0f), Board::get_position(row, col)), glm::vec3(0.183f));
+            scene.add(model.get(), transform, 1 + (row - 1) * 8 + (col - 'a'));
+        }
+    }
+
+    Camera camera(glm::vec3(0.0f, -8.0f, 6.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 16.0f / 9.0f, 0.1f, 100.0f);
+    glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, 1.0f, 25.0f);
+    Shader shader("resources/shaders/object.vert", "resources/shaders/object.frag");
+    // the lights of the default scene
+    vector <PointLight> pointLights(1, PointLight());
+    vector <SpotLight> spotLights(3, SpotLight());
+
+    std::cout << "benchmark,iterations,repeats,median_ns,min_ns,max_ns" << std::endl;
+
+    // the board
+    // ---------
+    run("board_get_piece_64", 100000, repeats, filter, [&](unsigned int) {
+        for (int row = 1; row <= 8; row++)
+            for (char col = 'a'; col <= 'h'; col++)
+                do_not_optimize(board.get_piece(row, col));
+    });
+    run("board_set_piece_move", 100000, repeats, filter, [&](unsigned int) {
+        board.set_piece(4, 'e', board.get_piece(2, 'e'));
+        board.set_piece(2, 'e', "");
+        board.set_piece(2, 'e', board.get_piece(4, 'e'));
+        board.set_piece(4, 'e', "");
+        do_not_optimize(board);
+    });
+    // what every frame does once a piece moved, to find the stale shadow faces
+    Board shadowBoard = board;
+    run("board_compare_64", 100000, repeats, filter, [&](unsigned int) {
+        unsigned int changed = 0;
+        for (int row = 1; row <= 8; row++)
+            for (char col = 'a'; col <= 'h'; col++)
+                changed += board.get_piece(row, col) != shadowBoard.get_piece(row, col);
+        do_not_optimize(changed);
+    });
+
+    // the per-frame draw list: classification against the camera and culling
+    // -----------------------------------------------------------------------
+    run("classify_instances", 100000, repeats, filter, [&](unsigned int) {
+        classify_instances(scene.instances, camera.Position, 1.5f);
+        do_not_optimize(scene.instances.front());
+    });
+    FrustumCuller culler;
+    run("frustum_culler_set_instances", 20000, repeats, filter, [&](unsigned int) {
+        culler.set_instances(scene.instances);
+        do_not_optimize(culler);
+    });
+    culler.set_instances(scene.instances); // whatever the filter skipped
+    Frustum frustum(projection * camera.GetViewMatrix());
+    run("frustum_cull", 100000, repeats, filter, [&](unsigned int) {
+        do_not_optimize(culler.cull(frustum));
+    });
+    run("frustum_cull_bvh", 100000, repeats, filter, [&](unsigned int) {
+        do_not_optimize(culler.cull(frustum, scene));
+    });
+    // the draw list renderOpaque sorts, a new one per camera pass
+    culler.cull(frustum);
+    run("draw_list_heap", 100000, repeats, filter, [&](unsigned int) {
+        vector <std::pair<float, unsigned int>> drawList;
+        front_to_back(scene.instances, culler, camera.Position, drawList);
+        do_not_optimize(drawList.data());
+    });
+    FrameArena frameArena(64u << 10);
+    run("draw_list_arena", 100000, repeats, filter, [&](unsigned int) {
+        frameArena.begin_frame();
+        FrameVector<std::pair<float, unsigned int>> drawList(frameArena);
+        front_to_back(scene.instances, culler, camera.Position, drawList);
+        do_not_optimize(drawList.data());
+    });
+
+    // uniforms: formatting the names setLightUniforms sets, looking them up once
+    // cached, then setting them the way the frame does
+    // ---------------------------------------------------------------------------
+    run("uniform_names_lights", 20000, repeats, filter, [&](unsigned int) {
+        for (unsigned int i = 0; i < pointLights.size(); i++) {
+            do_not_optimize(fmt::format("pointLights[{}].position", i));
+            do_not_optimize(fmt::format("pointLights[{}].ambient", i));
+            do_not_optimize(fmt::format("pointLights[{}].diffuse", i));
+            do_not_optimize(fmt::format("pointLights[{}].specular", i));
+            do_not_optimize(fmt::format("pointLights[{}].constant", i));
+            do_not_optimize(fmt::format("pointLights[{}].linear", i));
+            do_not_optimize(fmt::format("pointLights[{}].quadratic", i));
+        }
+        for (unsigned int i = 0; i < spotLights.size(); i++) {
+            do_not_optimize(fmt::format("spotLights[{}].position", i));
+            do_not_optimize(fmt::format("spotLights[{}].direction", i));
+            do_not_optimize(fmt::format("spotLights[{}].ambient", i));
+            do_not_optimize(fmt::format("spotLights[{}].diffuse", i));
+            do_not_optimize(fmt::format("spotLights[{}].specular", i));
+            do_not_optimize(fmt::format("spotLights[{}].constant", i));
+            do_not_optimize(fmt::format("spotLights[{}].linear", i));
+            do_not_optimize(fmt::format("spotLights[{}].quadratic", i));
+            do_not_optimize(fmt::format("spotLights[{}].cutOff", i));
+            do_not_optimize(fmt::format("spotLights[{}].outerCutOff", i));
+        }
+    });
+    run("uniform_names_lights_cached", 20000, repeats, filter, [&](unsigned int) {
+        for (unsigned int i = 0; i < pointLights.size(); i++) {
+            do_not_optimize(indexed_name("pointLights[{}].position", i));
+            do_not_optimize(indexed_name("pointLights[{}].ambient", i));
+            do_not_optimize(indexed_name("pointLights[{}].diffuse", i));
+            do_not_optimize(indexed_name("pointLights[{}].specular", i));
+            do_not_optimize(indexed_name("pointLights[{}].constant", i));
+            do_not_optimize(indexed_name("pointLights[{}].linear", i));
+            do_not_optimize(indexed_name("pointLights[{}].quadratic", i));
+        }
+        for (unsigned int i = 0; i < spotLights.size(); i++) {
+            do_not_optimize(indexed_name("spotLights[{}].position", i));
+            do_not_optimize(indexed_name("spotLights[{}].direction", i));
+            do_not_optimize(indexed_name("spotLights[{}].ambient", i));
+            do_not_optimize(indexed_name("spotLights[{}].diffuse", i));
+            do_not_optimize(indexed_name("spotLights[{}].specular", i));
+            do_not_optimize(indexed_name("spotLights[{}].constant", i));
+            do_not_optimize(indexed_name("spotLights[{}].linear", i));
+            do_not_optimize(indexed_name("spotLights[{}].quadratic", i));
+            do_not_optimize(indexed_name("spotLights[{}].cutOff", i));
+            do_not_optimize(indexed_name("spotLights[{}].outerCutOff", i));
+        }
+    });
+    run("uniform_set_lights", 20000, repeats, filter, [&](unsigned int) {
+        for (unsigned int i = 0; i < pointLights.size(); i++) {
+            shader.setVec3 (indexed_name("pointLights[{}].position" , i), pointLights[i].position);
+            shader.setVec3 (indexed_name("pointLights[{}].ambient"  , i), pointLights[i].ambient);
+            shader.setVec3 (indexed_name("pointLights[{}].diffuse"  , i), pointLights[i].diffuse);
+            shader.setVec3 (indexed_name("pointLights[{}].specular" , i), pointLights[i].specular);
+            shader.setFloat(indexed_name("pointLights[{}].constant" , i), pointLights[i].constant);
+            shader.setFloat(indexed_name("pointLights[{}].linear"   , i), pointLights[i].linear);
+            shader.setFloat(indexed_name("pointLights[{}].quadratic", i), pointLights[i].quadratic);
+        }
+        for (unsigned int i = 0; i < spotLights.size(); i++) {
+            shader.setVec3 (indexed_name("spotLights[{}].position"   , i), spotLights[i].position);
+            shader.setVec3 (indexed_name("spotLights[{}].direction"  , i), spotLights[i].direction);
+            shader.setVec3 (indexed_name("spotLights[{}].ambient"    , i), spotLights[i].ambient);
+            shader.setVec3 (indexed_name("spotLights[{}].diffuse"    , i), spotLights[i].diffuse);
+            shader.setVec3 (indexed_name("spotLights[{}].specular"   , i), spotLights[i].specular);
+            shader.setFloat(indexed_name("spotLights[{}].constant"   , i), spotLights[i].constant);
+            shader.setFloat(indexed_name("spotLights[{}].linear"     , i), spotLights[i].linear);
+            shader.setFloat(indexed_name("spotLights[{}].quadratic"  , i), spotLights[i].quadratic);
+            shader.setFloat(indexed_name("spotLights[{}].cutOff"     , i), spotLights[i].cutOff);
+            shader.setFloat(indexed_name("spotLights[{}].outerCutOff", i), spotLights[i].outerCutOff);
+        }
+    });
+    glm::mat4 shadowTransforms[6];
+    shadow_transforms(glm::vec3(0.0f, 0.0f, 4.0f), shadowProj, shadowTransforms);
+    run("uniform_set_shadow_matrices", 50000, repeats, filter, [&](unsigned int) {
+        for (unsigned int j = 0; j < 6; ++j)
+            shader.setMat4(indexed_name("shadowMatrices[{}]", j), shadowTransforms[j]);
+    });
+
+    // matrices
+    // --------
+    run("camera_view_matrix", 1000000, repeats, filter, [&](unsigned int) {
+        do_not_optimize(camera);
+        do_not_optimize(camera.GetViewMatrix());
+    });
+    run("shadow_transforms", 500000, repeats, filter, [&](unsigned int i) {
+        glm::vec3 lightPosition(0.0f, 0.0f, 4.0f);
+        do_not_optimize(lightPosition);
+        shadow_transforms(lightPosition, shadowProj, shadowTransforms);
+        do_not_optimize(shadowTransforms);
+    });
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef PROJECT_BASE_MOCK_GL_HPP
+#define PROJECT_BASE_MOCK_GL_HPP
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// An OpenGL without a context, for measuring the CPU side of code that issues
+// GL calls. Handed to gladLoadGLLoader, it reports a 3.3 context, hands out
+// object names and lets every shader compile and link; everything else does
+// nothing. Functions without an entry of their own all go to mock_gl_ignore,
+// which takes no arguments and returns 0: on x86-64 and AArch64 the caller
+// cleans up its arguments, so that is safe whatever the signature.
+struct MockGLStats {
+    unsigned int names;                 // the last object name handed out
+    unsigned long long uniformLookups;  // glGetUniformLocation calls
+    unsigned long long ignoredCalls;
+};
+
+inline MockGLStats &mock_gl_stats() {
+    static MockGLStats stats = {0, 0, 0};
+    return stats;
+}
+
+static void *APIENTRY mock_gl_ignore() {
+    mock_gl_stats().ignoredCalls++;
+    return nullptr;
+}
+
+static const GLubyte *APIENTRY mock_glGetString(GLenum name) {
+    return (const GLubyte *) (name == GL_VERSION ? "3.3.0 Mock" : "Mock");
+}
+
+// glad fails to load without at least one extension
+static const GLubyte *APIENTRY mock_glGetStringi(GLenum name, GLuint index) {
+    return (const GLubyte *) "GL_MOCK_none";
+}
+
+static void APIENTRY mock_glGetIntegerv(GLenum name, GLint *data) {
+    *data = name == GL_NUM_EXTENSIONS ? 1 : 0;
+}
+
+static void APIENTRY mock_glGenNames(GLsizei n, GLuint *names) {
+    for (GLsizei i = 0; i < n; i++)
+        names[i] = ++mock_gl_stats().names;
+}
+
+static GLuint APIENTRY mock_glCreateShader(GLenum type) {
+    return ++mock_gl_stats().names;
+}
+
+static GLuint APIENTRY mock_glCreateProgram() {
+    return ++mock_gl_stats().names;
+}
+
+// compile and link status, an empty info log
+static void APIENTRY mock_glGetStatus(GLuint object, GLenum name, GLint *params) {
+    *params = name == GL_INFO_LOG_LENGTH ? 0 : 1;
+}
+
+static GLint APIENTRY mock_glGetUniformLocation(GLuint program, const GLchar *name) {
+    mock_gl_stats().uniformLookups++;
+    return 0;
+}
+
+inline void *mock_gl_loader(const char *name) {
+    static const struct {
+        const char *name;
+        void *function;
+    } entries[] = {
+        {"glGetString", (void *) mock_glGetString},
+        {"glGetStringi", (void *) mock_glGetStringi},
+        {"glGetIntegerv", (void *) mock_glGetIntegerv},
+        {"glGenBuffers", (void *) mock_glGenNames},
+        {"glGenVertexArrays", (void *) mock_glGenNames},
+        {"glGenTextures", (void *) mock_glGenNames},
+        {"glGenFramebuffers", (void *) mock_glGenNames},
+        {"glGenRenderbuffers", (void *) mock_glGenNames},
+        {"glGenQueries", (void *) mock_glGenNames},
+        {"glCreateShader", (void *) mock_glCreateShader},
+        {"glCreateProgram", (void *) mock_glCreateProgram},
+        {"glGetShaderiv", (void *) mock_glGetStatus},
+        {"glGetProgramiv", (void *) mock_glGetStatus},
+        {"glGetUniformLocation", (void *) mock_glGetUniformLocation},
+    };
+    for (const auto &entry : entries) {
+        if (std::strcmp(entry.name, name) == 0)
+            return entry.function;
+    }
+    return (void *) mock_gl_ignore;
+}
+
+#endif //PROJECT_BASE_MOCK_GL_HPP
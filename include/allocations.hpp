@@ -0,0 +1,63 @@
+#ifndef PROJECT_BASE_ALLOCATIONS_HPP
+#define PROJECT_BASE_ALLOCATIONS_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+// Heap allocations made through operator new, counted per thread. The global
+// operators in src/allocations.cpp replace the standard ones for the whole
+// executable and count through counted_allocation. Allocations of C code, e.g.
+// malloc in GLFW or the driver, aren't seen.
+struct AllocationCounts {
+    unsigned long long allocations;
+    unsigned long long bytes;
+
+    AllocationCounts since(const AllocationCounts &start) const { return {allocations - start.allocations, bytes - start.bytes}; }
+};
+
+// the calling thread's allocations since it started
+inline AllocationCounts &thread_allocations() {
+    static thread_local AllocationCounts counts = {0, 0};
+    return counts;
+}
+
+// While a thread forbids allocations, the first one it makes outside of an
+// AllowAllocations scope prints its size and the innermost CPU zone, then
+// aborts, so a debugger stops right at it.
+struct AllocationCheck {
+    bool forbidden;
+    int allowed;      // open AllowAllocations scopes
+    const char *zone; // innermost CpuZone, see cpu_profiler.hpp
+};
+
+inline AllocationCheck &thread_allocation_check() {
+    static thread_local AllocationCheck check = {false, 0, nullptr};
+    return check;
+}
+
+// Work that may allocate even in a frame that otherwise must not, e.g. reports
+// printed now and then or caches filled on first use.
+class AllowAllocations {
+public:
+    AllowAllocations() { thread_allocation_check().allowed++; }
+    ~AllowAllocations() { thread_allocation_check().allowed--; }
+    AllowAllocations(const AllowAllocations &) = delete;
+    AllowAllocations &operator=(const AllowAllocations &) = delete;
+};
+
+inline void *counted_allocation(std::size_t size) {
+    AllocationCounts &counts = thread_allocations();
+    counts.allocations++;
+    counts.bytes += size;
+    AllocationCheck &check = thread_allocation_check();
+    if (check.forbidden && check.allowed == 0) {
+        // stdio allocates with malloc, if at all, so this doesn't come back here
+        std::fprintf(stderr, "Allocation of %zu bytes in a frame that must not allocate, in zone %s\n",
+                     size, check.zone ? check.zone : "(none)");
+        std::abort();
+    }
+    return std::malloc(size ? size : 1);
+}
+
+#endif //PROJECT_BASE_ALLOCATIONS_HPP
@@ -0,0 +1,442 @@
+#ifndef PROJECT_BASE_BENCHMARK_HPP
+#define PROJECT_BASE_BENCHMARK_HPP
+
+#include <fmt/core.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <ostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <cpu_profiler.hpp>
+#include <frame_stats.hpp>
+#include <frustum_culling.hpp>
+#include <gpu_queries.hpp>
+#include <render_stats.hpp>
+#include <scene.hpp>
+#include <shadows.hpp>
+
+// Renders the scene with a growing number of event lights, once through the
+// brute-force loop and once through the light clusters, and reports the mean
+// frame time of each step. Every step skips a few warm-up frames first.
+class LightCountSweep {
+public:
+    LightCountSweep(std::vector<int> _counts, int _warmupFrames, int _measuredFrames);
+    bool done() const { return step >= counts.size() * 2; }
+    int light_count() const { return counts[step / 2]; }
+    bool clustered() const { return step % 2 == 1; }
+    // records the time of the frame that was just rendered with the current step
+    void frame_finished(float frameSeconds);
+    void write_csv(std::ostream &out) const;
+
+private:
+    std::vector<int> counts;
+    int warmupFrames;
+    int measuredFrames;
+    unsigned int step;
+    int frame;
+    double total;
+    std::vector<double> results; // mean seconds per step
+};
+
+LightCountSweep::LightCountSweep(std::vector<int> _counts, int _warmupFrames, int _measuredFrames) :
+    counts(std::move(_counts)),
+    warmupFrames(_warmupFrames),
+    measuredFrames(_measuredFrames),
+    step(0),
+    frame(0),
+    total(0.0) {}
+
+void LightCountSweep::frame_finished(float frameSeconds) {
+    if (done())
+        return;
+    if (frame++ >= warmupFrames)
+        total += frameSeconds;
+    if (frame == warmupFrames + measuredFrames) {
+        results.push_back(total / measuredFrames);
+        step++;
+        frame = 0;
+        total = 0.0;
+    }
+}
+
+void LightCountSweep::write_csv(std::ostream &out) const {
+    out << "lights,path,frame_ms\n";
+    for (unsigned int i = 0; i < results.size(); i++)
+        out << fmt::format("{},{},{:.3f}\n", counts[i / 2], i % 2 ? "clustered" : "brute_force", results[i] * 1000.0);
+}
+
+// One configuration of SceneScalingSweep.
+struct ScalingCell {
+    int boards;
+    int lights;
+    unsigned int shadowSize;
+    ShadowFilter shadowFilter;
+    bool culling;
+};
+
+// Renders every combination of board count, event light count, shadow map
+// size, shadow filter and frustum culling on and off through the regular frame
+// loop, and reports the mean frame time, draw calls and state changes of each
+// after a few warm-up frames.
+class SceneScalingSweep {
+public:
+    SceneScalingSweep(const std::vector<int> &boards, const std::vector<int> &lights, const std::vector<unsigned int> &shadowSizes,
+                      const std::vector<ShadowFilter> &shadowFilters, int _warmupFrames, int _measuredFrames);
+    bool done() const { return step >= cells.size(); }
+    const ScalingCell &cell() const { return cells[step]; }
+    // the frame about to be rendered is the first of its cell, set it up; true
+    // before the first frame too
+    bool cell_started() const { return frame == 0; }
+    // records the frame that was just rendered with the current cell
+    void frame_finished(float frameSeconds, const RenderStats &stats);
+    void write_csv(std::ostream &out) const;
+
+private:
+    struct Result {
+        double frameSeconds;
+        double drawCalls;
+        double stateChanges;
+    };
+
+    std::vector<ScalingCell> cells;
+    int warmupFrames;
+    int measuredFrames;
+    unsigned int step;
+    int frame;
+    Result total;
+    std::vector<Result> results; // means per cell
+};
+
+SceneScalingSweep::SceneScalingSweep(const std::vector<int> &boards, const std::vector<int> &lights, const std::vector<unsigned int> &shadowSizes,
+                                     const std::vector<ShadowFilter> &shadowFilters, int _warmupFrames, int _measuredFrames) :
+    warmupFrames(_warmupFrames),
+    measuredFrames(_measuredFrames),
+    step(0),
+    frame(0),
+    total({0.0, 0.0, 0.0}) {
+    for (int boardCount : boards)
+        for (int lightCount : lights)
+            for (unsigned int shadowSize : shadowSizes)
+                for (ShadowFilter shadowFilter : shadowFilters)
+                    for (bool culling : {false, true})
+                        cells.push_back({boardCount, lightCount, shadowSize, shadowFilter, culling});
+}
+
+void SceneScalingSweep::frame_finished(float frameSeconds, const RenderStats &stats) {
+    if (done())
+        return;
+    if (frame++ >= warmupFrames) {
+        total.frameSeconds += frameSeconds;
+        total.drawCalls += (double) stats.drawCalls;
+        total.stateChanges += (double) stats.state_changes();
+    }
+    if (frame == warmupFrames + measuredFrames) {
+        results.push_back({total.frameSeconds / measuredFrames, total.drawCalls / measuredFrames, total.stateChanges / measuredFrames});
+        step++;
+        frame = 0;
+        total = {0.0, 0.0, 0.0};
+    }
+}
+
+void SceneScalingSweep::write_csv(std::ostream &out) const {
+    out << "boards,lights,shadow_size,shadow_filter,culling,frame_ms,draw_calls,state_changes\n";
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const ScalingCell &c = cells[i];
+        out << fmt::format("{},{},{},{},{},{:.3f},{:.0f},{:.0f}\n", c.boards, c.lights, c.shadowSize, shadow_filter_name(c.shadowFilter),
+                           c.culling ? "on" : "off", results[i].frameSeconds * 1000.0, results[i].drawCalls, results[i].stateChanges);
+    }
+}
+
+// Times the spatial queries of a scene through its BVH and by testing every
+// instance, over the same random cameras, light spheres and rays inside the
+// scene bounds, and appends one CSV row per query kind: the mean microseconds
+// per query each way and the mean hits. Moving instances only costs the BVH a
+// refit, the flat list has nothing to maintain.
+inline void write_scene_benchmark(Scene &scene, unsigned int boards, glm::vec3 boundsMin, glm::vec3 boundsMax,
+                                  std::ostream &out, bool header) {
+    const int QUERIES = 256, REPEATS = 10;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto point = [&](float z0, float z1) {
+        glm::vec3 t(unit(random), unit(random), 0.0f);
+        glm::vec3 p = boundsMin + t * (boundsMax - boundsMin);
+        p.z = z0 + unit(random) * (z1 - z0);
+        return p;
+    };
+    std::vector<Frustum> frusta;
+    std::vector<std::pair<glm::vec3, float>> spheres;
+    std::vector<std::pair<glm::vec3, glm::vec3>> rays;
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.5f, 0.1f, 100.0f);
+    for (int i = 0; i < QUERIES; i++) {
+        glm::vec3 eye = point(2.0f, 10.0f), target = point(0.0f, 0.0f);
+        frusta.emplace_back(projection * glm::lookAt(eye, target, glm::vec3(0.0f, 0.0f, 1.0f)));
+        spheres.emplace_back(point(0.5f, 5.0f), 2.0f + 4.0f * unit(random));
+        rays.emplace_back(eye, glm::normalize(target - eye));
+    }
+
+    auto time = [&](auto &&query) {
+        auto start = std::chrono::steady_clock::now();
+        size_t hits = 0;
+        for (int repeat = 0; repeat < REPEATS; repeat++)
+            hits = query();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return std::make_pair(seconds * 1e6 / (REPEATS * QUERIES), (double) hits / QUERIES);
+    };
+    auto row = [&](const char *query, std::pair<double, double> bvh, std::pair<double, double> bruteForce) {
+        if (bvh.second != bruteForce.second)
+            std::cerr << fmt::format("Scene benchmark: {} hits differ, {} with the BVH, {} without", query, bvh.second, bruteForce.second) << std::endl;
+        out << fmt::format("{},{},{},{:.3f},{:.3f},{:.1f}\n", boards, scene.instances.size(), query, bvh.first, bruteForce.first, bvh.second);
+    };
+    const std::vector<SceneInstance> &instances = scene.instances;
+    std::vector<unsigned int> result;
+    std::vector<std::pair<float, unsigned int>> rayResult;
+
+    if (header)
+        out << "boards,instances,query,bvh_us,brute_force_us,hits\n";
+    row("frustum", time([&] {
+        size_t hits = 0;
+        for (const Frustum &frustum : frusta) {
+            result.clear();
+            scene.query_frustum(frustum.planes, result);
+            hits += result.size();
+        }
+        return hits;
+    }), time([&] {
+        size_t hits = 0;
+        for (const Frustum &frustum : frusta) {
+            for (const SceneInstance &instance : instances)
+                hits += box_in_frustum(instance.boundsMin, instance.boundsMax, frustum.planes);
+        }
+        return hits;
+    }));
+    row("light", time([&] {
+        size_t hits = 0;
+        for (auto &sphere : spheres) {
+            result.clear();
+            scene.query_sphere(sphere.first, sphere.second, result);
+            hits += result.size();
+        }
+        return hits;
+    }), time([&] {
+        size_t hits = 0;
+        for (auto &sphere : spheres) {
+            for (const SceneInstance &instance : instances)
+                hits += box_overlaps_sphere(instance.boundsMin, instance.boundsMax, sphere.first, sphere.second);
+        }
+        return hits;
+    }));
+    row("ray", time([&] {
+        size_t hits = 0;
+        for (auto &ray : rays) {
+            rayResult.clear();
+            scene.query_ray(ray.first, ray.second, 100.0f, rayResult);
+            hits += rayResult.size();
+        }
+        return hits;
+    }), time([&] {
+        size_t hits = 0;
+        for (auto &ray : rays) {
+            rayResult.clear();
+            glm::vec3 inverseDirection = 1.0f / ray.second;
+            float entry;
+            for (unsigned int i = 0; i < instances.size(); i++) {
+                if (ray_hits_box(ray.first, inverseDirection, 100.0f, instances[i].boundsMin, instances[i].boundsMax, entry))
+                    rayResult.emplace_back(entry, i);
+            }
+            std::sort(rayResult.begin(), rayResult.end());
+            hits += rayResult.size();
+        }
+        return hits;
+    }));
+
+    // every move goes a little way and comes back, the tree ends up as it was
+    std::uniform_int_distribution<unsigned int> pick(0, (unsigned int) instances.size() - 1);
+    std::vector<unsigned int> moved;
+    for (int i = 0; i < QUERIES; i++)
+        moved.push_back(pick(random));
+    std::pair<double, double> refit = time([&] {
+        for (unsigned int index : moved) {
+            Model *model = instances[index].model;
+            glm::mat4 transform = instances[index].transform;
+            scene.set(index, model, glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 0.0f, 0.0f)) * transform);
+            scene.set(index, model, transform);
+        }
+        return (size_t) 0;
+    });
+    refit.first /= 2.0;
+    row("move", refit, std::make_pair(0.0, 0.0));
+}
+
+// resident set size of the process, 0 where it is unknown
+inline size_t process_resident_bytes() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (statm >> pages >> resident)
+        return resident * (size_t) sysconf(_SC_PAGESIZE);
+#endif
+    return 0;
+}
+
+inline std::string json_string(const std::string &value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        if ((unsigned char) c >= 0x20)
+            quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// Renders a fixed number of frames along a scripted orbit of the camera, so
+// every run sees the same views, and reports the measured frames as JSON:
+// frame time percentiles, CPU zones, their heap allocations and GPU passes per
+// frame, meshes drawn and memory. The warm-up frames compile the shader variants and fill the
+// shadow maps first.
+class FrameBenchmark {
+public:
+    FrameBenchmark(int _warmupFrames, int _measuredFrames);
+    bool done() const { return frame >= warmupFrames + measuredFrames; }
+    // one turn around the board over the measured frames, rising and sinking twice
+    void camera_pose(glm::vec3 &position, float &yaw, float &pitch) const;
+    // records the frame that was just rendered
+    void frame_finished(float frameSeconds, const CullStats &camera, const CullStats &shadows);
+    // CPU zones since the first measured frame, see CpuProfiler::zone_totals
+    uint64_t measure_start() const { return measureStart; }
+    // settings are names and JSON values, the GPU averages should span the measured frames
+    void write_json(std::ostream &out, const std::vector<std::pair<std::string, std::string>> &settings,
+                    const std::map<std::string, CpuProfiler::ZoneTotal> &cpuZones, const GpuProfiler &gpuProfiler,
+                    const std::vector<std::pair<std::string, size_t>> &memory) const;
+
+private:
+    int warmupFrames;
+    int measuredFrames;
+    int frame;
+    uint64_t measureStart;
+    FrameStats frameStats;
+    double cameraMeshes;
+    double shadowMeshes;
+};
+
+FrameBenchmark::FrameBenchmark(int _warmupFrames, int _measuredFrames) :
+    warmupFrames(_warmupFrames),
+    measuredFrames(_measuredFrames),
+    frame(0),
+    measureStart(0),
+    frameStats((unsigned int) _measuredFrames),
+    cameraMeshes(0.0),
+    shadowMeshes(0.0) {}
+
+void FrameBenchmark::camera_pose(glm::vec3 &position, float &yaw, float &pitch) const {
+    float angle = 2.0f * 3.14159265f * (float) (frame - warmupFrames) / (float) measuredFrames;
+    position = glm::vec3(10.0f * std::sin(angle), -10.0f * std::cos(angle), 6.0f + 3.0f * std::sin(2.0f * angle));
+    // at the center of the board, see Camera::updateCameraVectors
+    glm::vec3 front = glm::normalize(-position);
+    yaw = glm::degrees(std::atan2(front.x, front.y));
+    pitch = glm::degrees(std::asin(front.z));
+}
+
+void FrameBenchmark::frame_finished(float frameSeconds, const CullStats &camera, const CullStats &shadows) {
+    if (done())
+        return;
+    if (frame >= warmupFrames) {
+        frameStats.add(frameSeconds);
+        cameraMeshes += camera.drawn;
+        shadowMeshes += shadows.drawn;
+    }
+    frame++;
+    if (frame == warmupFrames)
+        measureStart = CpuProfiler::now();
+}
+
+void FrameBenchmark::write_json(std::ostream &out, const std::vector<std::pair<std::string, std::string>> &settings,
+                                const std::map<std::string, CpuProfiler::ZoneTotal> &cpuZones, const GpuProfiler &gpuProfiler,
+                                const std::vector<std::pair<std::string, size_t>> &memory) const {
+    auto object = [&](const char *name, const std::vector<std::string> &members, bool last = false) {
+        out << fmt::format("  {}: {{", json_string(name));
+        for (unsigned int i = 0; i < members.size(); i++)
+            out << (i ? ",\n    " : "\n    ") << members[i];
+        out << (members.empty() ? "}" : "\n  }") << (last ? "\n" : ",\n");
+    };
+    std::vector<std::string> members;
+    out << "{\n";
+    for (auto &setting : settings)
+        members.push_back(fmt::format("{}: {}", json_string(setting.first), setting.second));
+    members.push_back(fmt::format("\"warmup_frames\": {}", warmupFrames));
+    members.push_back(fmt::format("\"measured_frames\": {}", measuredFrames));
+    object("settings", members);
+
+    object("frame_ms", {
+        fmt::format("\"mean\": {:.3f}", frameStats.mean()),
+        fmt::format("\"p50\": {:.3f}", frameStats.percentile(50.0f)),
+        fmt::format("\"p95\": {:.3f}", frameStats.percentile(95.0f)),
+        fmt::format("\"p99\": {:.3f}", frameStats.percentile(99.0f)),
+        fmt::format("\"max\": {:.3f}", frameStats.percentile(100.0f)),
+        fmt::format("\"one_percent_low_fps\": {:.1f}", frameStats.one_percent_low_fps()),
+        fmt::format("\"stutters\": {}", frameStats.stutters())
+    });
+
+    // per frame zone the rings still hold, long runs overwrite the first ones
+    members.clear();
+    auto frameZone = cpuZones.find("frame");
+    double zoneFrames = frameZone != cpuZones.end() ? (double) frameZone->second.calls : (double) measuredFrames;
+    for (auto &zone : cpuZones)
+        members.push_back(fmt::format("{}: {:.4f}", json_string(zone.first), zone.second.milliseconds / zoneFrames));
+    object("cpu_ms_per_frame", members);
+
+    // heap allocations of the zones that made any, nested zones included
+    members.clear();
+    for (auto &zone : cpuZones) {
+        if (zone.second.allocations > 0)
+            members.push_back(fmt::format("{}: {{\"allocations\": {:.2f}, \"bytes\": {:.0f}}}", json_string(zone.first),
+                                          (double) zone.second.allocations / zoneFrames, (double) zone.second.allocatedBytes / zoneFrames));
+    }
+    object("allocations_per_frame", members);
+
+    members.clear();
+    for (unsigned int pass = 0; pass < gpuProfiler.passes(); pass++)
+        members.push_back(fmt::format("{}: {:.4f}", json_string(gpuProfiler.pass_name(pass)), gpuProfiler.average(pass)));
+    object("gpu_ms_per_frame", members);
+
+    // with --pipeline-stats, the counts of the last frame read back
+    if (gpuProfiler.statistics) {
+        members.clear();
+        for (unsigned int pass = 0; pass < gpuProfiler.passes(); pass++) {
+            std::string counts;
+            for (int i = 0; i < PIPELINE_STATISTIC_COUNT; i++)
+                counts += fmt::format("{}{}: {}", i ? ", " : "", json_string(pipeline_statistic_name((PipelineStatistic) i)),
+                                      gpuProfiler.pass_statistics(pass)[i]);
+            members.push_back(fmt::format("{}: {{{}}}", json_string(gpuProfiler.pass_name(pass)), counts));
+        }
+        object("pipeline_statistics", members);
+    }
+
+    object("meshes_drawn_per_frame", {
+        fmt::format("\"camera\": {:.1f}", cameraMeshes / measuredFrames),
+        fmt::format("\"shadows\": {:.1f}", shadowMeshes / measuredFrames)
+    });
+
+    members.clear();
+    for (auto &entry : memory)
+        members.push_back(fmt::format("{}: {}", json_string(entry.first), entry.second));
+    members.push_back(fmt::format("\"process_resident\": {}", process_resident_bytes()));
+    object("memory_bytes", members, true);
+    out << "}\n";
+}
+
+#endif //PROJECT_BASE_BENCHMARK_HPP
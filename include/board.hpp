@@ -10,8 +10,10 @@
 class Board {
 public:
     vector <vector<string>> board;
+    // bumped on every change, lets cached data (e.g. shadow maps) detect moves
+    unsigned int revision;
     static glm::vec3 get_position(int row, char col);
-    string get_piece(int row, char col);
+    const string &get_piece(int row, char col) const;
     void set_piece(int row, char col, string piece);
     Board();
 
@@ -19,7 +21,7 @@ private:
 
 };
 
-Board::Board() {
+Board::Board() : revision(0) {
     board.resize(8);
     for(int i = 0; i < 8; i++) {
         board[i] = vector<string>(8, "");
@@ -54,7 +56,7 @@ glm::vec3 Board::get_position(int row, char col) {
     return {-3.5f+(float)col,-3.5f+(float)row,0.0f};
 }
 
-string Board::get_piece(int row, char col) {
+const string &Board::get_piece(int row, char col) const {
     col -= 'a';
     row -= 1;
     return board[row][col];
@@ -64,6 +66,7 @@ void Board::set_piece(int row, char col, string piece) {
     col -= 'a';
     row -= 1;
     board[row][col] = std::move(piece);
+    revision++;
 }
 
 #endif //PROJECT_BASE_BOARD_HPP
@@ -0,0 +1,243 @@
+#ifndef PROJECT_BASE_BVH_HPP
+#define PROJECT_BASE_BVH_HPP
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <vector>
+
+inline float box_surface_area(glm::vec3 boundsMin, glm::vec3 boundsMax) {
+    glm::vec3 size = boundsMax - boundsMin;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+inline bool box_overlaps_box(glm::vec3 aMin, glm::vec3 aMax, glm::vec3 bMin, glm::vec3 bMax) {
+    return aMin.x <= bMax.x && aMax.x >= bMin.x && aMin.y <= bMax.y && aMax.y >= bMin.y && aMin.z <= bMax.z && aMax.z >= bMin.z;
+}
+
+inline bool box_overlaps_sphere(glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3 center, float radius) {
+    glm::vec3 offset = glm::clamp(center, boundsMin, boundsMax) - center;
+    return glm::dot(offset, offset) <= radius * radius;
+}
+
+// planes as in Frustum, inside where dot(plane, (p, 1)) >= 0
+inline bool box_in_frustum(glm::vec3 boundsMin, glm::vec3 boundsMax, const glm::vec4 planes[6]) {
+    for (int i = 0; i < 6; i++) {
+        // the corner farthest along the plane normal
+        glm::vec3 corner(planes[i].x >= 0.0f ? boundsMax.x : boundsMin.x,
+                         planes[i].y >= 0.0f ? boundsMax.y : boundsMin.y,
+                         planes[i].z >= 0.0f ? boundsMax.z : boundsMin.z);
+        if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// slab test, distance along the ray where it enters the box in entry
+inline bool ray_hits_box(glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance,
+                         glm::vec3 boundsMin, glm::vec3 boundsMax, float &entry) {
+    glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+    glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+    glm::vec3 entries = glm::min(t0, t1), exits = glm::max(t0, t1);
+    entry = glm::max(glm::max(entries.x, entries.y), glm::max(entries.z, 0.0f));
+    float exit = glm::min(glm::min(exits.x, exits.y), glm::min(exits.z, maxDistance));
+    return entry <= exit;
+}
+
+// Dynamic bounding volume hierarchy over boxes of caller-defined items.
+// Leaves are inserted next to the sibling that grows the least in surface
+// area, and moving a leaf only refits the boxes on its path to the root.
+class DynamicBVH {
+public:
+    DynamicBVH() : root(-1), freeList(-1), leafCount(0) {};
+    // returns the leaf, which identifies the item in update and remove
+    int insert(unsigned int item, glm::vec3 boundsMin, glm::vec3 boundsMax);
+    void remove(int leaf);
+    // new bounds of a leaf that moved
+    void update(int leaf, glm::vec3 boundsMin, glm::vec3 boundsMax);
+    void set_item(int leaf, unsigned int item) { nodes[leaf].item = item; }
+    unsigned int size() const { return leafCount; }
+    // visits the items of the leaves whose boxes pass the test, like the nodes above them
+    template<typename Test, typename Visit>
+    void query(Test test, Visit visit) const;
+    // sum of the node surface areas relative to the root, lower is a better tree
+    float cost() const;
+
+private:
+    struct Node {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        int parent;
+        int children[2]; // -1 for leaves
+        unsigned int item;
+        int nextFree;
+
+        bool leaf() const { return children[0] < 0; }
+    };
+
+    std::vector<Node> nodes;
+    int root;
+    int freeList;
+    unsigned int leafCount;
+    mutable std::vector<int> stack;
+
+    int allocate_node();
+    void free_node(int node);
+    void refit(int node);
+};
+
+int DynamicBVH::allocate_node() {
+    int node;
+    if (freeList >= 0) {
+        node = freeList;
+        freeList = nodes[node].nextFree;
+    } else {
+        node = (int) nodes.size();
+        nodes.emplace_back();
+    }
+    nodes[node].parent = -1;
+    nodes[node].children[0] = nodes[node].children[1] = -1;
+    nodes[node].item = 0;
+    nodes[node].nextFree = -1;
+    return node;
+}
+
+void DynamicBVH::free_node(int node) {
+    nodes[node].nextFree = freeList;
+    freeList = node;
+}
+
+void DynamicBVH::refit(int node) {
+    while (node >= 0) {
+        Node &n = nodes[node];
+        glm::vec3 boundsMin = glm::min(nodes[n.children[0]].boundsMin, nodes[n.children[1]].boundsMin);
+        glm::vec3 boundsMax = glm::max(nodes[n.children[0]].boundsMax, nodes[n.children[1]].boundsMax);
+        // the ancestors only change if this box did
+        if (boundsMin == n.boundsMin && boundsMax == n.boundsMax)
+            return;
+        n.boundsMin = boundsMin;
+        n.boundsMax = boundsMax;
+        node = n.parent;
+    }
+}
+
+int DynamicBVH::insert(unsigned int item, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+    int leaf = allocate_node();
+    nodes[leaf].boundsMin = boundsMin;
+    nodes[leaf].boundsMax = boundsMax;
+    nodes[leaf].item = item;
+    leafCount++;
+    if (root < 0) {
+        root = leaf;
+        return leaf;
+    }
+
+    // descend to the sibling that is cheapest to pair with, counting the growth
+    // of every box on the way down
+    int sibling = root;
+    while (!nodes[sibling].leaf()) {
+        const Node &n = nodes[sibling];
+        float area = box_surface_area(n.boundsMin, n.boundsMax);
+        float combined = box_surface_area(glm::min(n.boundsMin, boundsMin), glm::max(n.boundsMax, boundsMax));
+        float pairHere = 2.0f * combined;
+        float inherited = 2.0f * (combined - area);
+        float childCost[2];
+        for (int i = 0; i < 2; i++) {
+            const Node &child = nodes[n.children[i]];
+            float grown = box_surface_area(glm::min(child.boundsMin, boundsMin), glm::max(child.boundsMax, boundsMax));
+            childCost[i] = (child.leaf() ? grown : grown - box_surface_area(child.boundsMin, child.boundsMax)) + inherited;
+        }
+        if (pairHere < childCost[0] && pairHere < childCost[1])
+            break;
+        sibling = childCost[0] <= childCost[1] ? n.children[0] : n.children[1];
+    }
+
+    int oldParent = nodes[sibling].parent;
+    int parent = allocate_node();
+    nodes[parent].parent = oldParent;
+    nodes[parent].children[0] = sibling;
+    nodes[parent].children[1] = leaf;
+    nodes[parent].boundsMin = glm::min(nodes[sibling].boundsMin, boundsMin);
+    nodes[parent].boundsMax = glm::max(nodes[sibling].boundsMax, boundsMax);
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+    if (oldParent < 0) {
+        root = parent;
+    } else {
+        Node &p = nodes[oldParent];
+        p.children[p.children[0] == sibling ? 0 : 1] = parent;
+        refit(oldParent);
+    }
+    return leaf;
+}
+
+void DynamicBVH::remove(int leaf) {
+    leafCount--;
+    int parent = nodes[leaf].parent;
+    free_node(leaf);
+    if (parent < 0) {
+        root = -1;
+        return;
+    }
+    // the sibling takes the parent's place
+    int sibling = nodes[parent].children[nodes[parent].children[0] == leaf ? 1 : 0];
+    int grandParent = nodes[parent].parent;
+    nodes[sibling].parent = grandParent;
+    free_node(parent);
+    if (grandParent < 0) {
+        root = sibling;
+    } else {
+        Node &g = nodes[grandParent];
+        g.children[g.children[0] == parent ? 0 : 1] = sibling;
+        refit(grandParent);
+    }
+}
+
+void DynamicBVH::update(int leaf, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+    nodes[leaf].boundsMin = boundsMin;
+    nodes[leaf].boundsMax = boundsMax;
+    if (nodes[leaf].parent >= 0)
+        refit(nodes[leaf].parent);
+}
+
+template<typename Test, typename Visit>
+void DynamicBVH::query(Test test, Visit visit) const {
+    if (root < 0)
+        return;
+    // never holds more entries than the tree has nodes, so queries stop allocating
+    stack.reserve(nodes.size());
+    stack.clear();
+    stack.push_back(root);
+    while (!stack.empty()) {
+        const Node &n = nodes[stack.back()];
+        stack.pop_back();
+        if (!test(n.boundsMin, n.boundsMax))
+            continue;
+        if (n.leaf()) {
+            visit(n.item);
+        } else {
+            stack.push_back(n.children[0]);
+            stack.push_back(n.children[1]);
+        }
+    }
+}
+
+float DynamicBVH::cost() const {
+    if (root < 0)
+        return 0.0f;
+    float total = 0.0f;
+    stack.clear();
+    stack.push_back(root);
+    while (!stack.empty()) {
+        const Node &n = nodes[stack.back()];
+        stack.pop_back();
+        total += box_surface_area(n.boundsMin, n.boundsMax);
+        if (!n.leaf()) {
+            stack.push_back(n.children[0]);
+            stack.push_back(n.children[1]);
+        }
+    }
+    return total / glm::max(box_surface_area(nodes[root].boundsMin, nodes[root].boundsMax), 1e-6f);
+}
+
+#endif //PROJECT_BASE_BVH_HPP
@@ -0,0 +1,254 @@
+#ifndef PROJECT_BASE_CLUSTERS_HPP
+#define PROJECT_BASE_CLUSTERS_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <learnopengl/shader.h>
+#include <lights.hpp>
+
+// One unshadowed light as stored in the light texture buffer, 4 RGBA32F texels.
+// Layout must match CalcEventLight in object.frag.
+struct ClusterLight {
+    glm::vec4 positionRange;    // xyz position, w attenuation range
+    glm::vec4 colorType;        // rgb diffuse and specular color, w 0 = point, 1 = spot
+    glm::vec4 attenuationOuter; // constant, linear, quadratic, cos of the outer cutoff
+    glm::vec4 directionInner;   // xyz spot direction, w cos of the inner cutoff
+};
+
+inline ClusterLight cluster_light(const PointLight &light) {
+    return {
+        glm::vec4(light.position, light.range()),
+        glm::vec4(light.diffuse, 0.0f),
+        glm::vec4(light.constant, light.linear, light.quadratic, -1.0f),
+        glm::vec4(0.0f, 0.0f, -1.0f, -1.0f)
+    };
+}
+
+inline ClusterLight cluster_light(const SpotLight &light) {
+    return {
+        glm::vec4(light.position, light.range()),
+        glm::vec4(light.diffuse, 1.0f),
+        glm::vec4(light.constant, light.linear, light.quadratic, light.outerCutOff),
+        glm::vec4(light.direction, light.cutOff)
+    };
+}
+
+// Clustered forward lighting: the view frustum is split into DIM_X x DIM_Y
+// screen tiles and DIM_Z exponential depth slices. Every frame each light's
+// bounding sphere (and cone, for spots) is intersected with the cluster boxes
+// on the CPU, and the per-cluster light lists are uploaded as texture buffers
+// so a fragment only loops over the lights of its own cluster.
+class LightClusters {
+public:
+    static const unsigned int DIM_X = 16, DIM_Y = 9, DIM_Z = 24;
+
+    LightClusters(float _near, float _far);
+    void update(const std::vector<ClusterLight> &lights, const glm::mat4 &view, float fovY, float aspect);
+    // binds the three texture buffers to units firstUnit..firstUnit+2 and sets the uniforms
+    void bind(Shader &shader, int firstUnit) const;
+    // number of light-cluster pairs after culling
+    unsigned int assignments() const { return (unsigned int) indices.size(); }
+
+private:
+    float near;
+    float far;
+    float tanY;
+    float aspect;
+    unsigned int lightCount;
+
+    // kept between frames so a steady light count doesn't reallocate
+    std::vector<glm::vec3> boxMin, boxMax; // view space cluster bounds
+    std::vector<unsigned int> pairs;       // cluster << 16 | light
+    std::vector<unsigned int> grid;        // offset, count per cluster
+    std::vector<unsigned int> indices;     // light indices, grouped by cluster
+    unsigned int lightBuffer, gridBuffer, indexBuffer;
+    unsigned int lightTexture, gridTexture, indexTexture;
+
+    void build_boxes(float fovY, float _aspect);
+    float slice_depth(unsigned int slice) const;
+};
+
+LightClusters::LightClusters(float _near, float _far) :
+    near(_near),
+    far(_far),
+    tanY(0.0f),
+    aspect(0.0f),
+    lightCount(0) {
+
+    unsigned int buffers[3], textures[3];
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    lightBuffer = buffers[0]; gridBuffer = buffers[1]; indexBuffer = buffers[2];
+    lightTexture = textures[0]; gridTexture = textures[1]; indexTexture = textures[2];
+
+    const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+    for (int i = 0; i < 3; i++) {
+        // a texture buffer needs a data store even when there are no lights
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+float LightClusters::slice_depth(unsigned int slice) const {
+    return near * std::pow(far / near, (float) slice / (float) DIM_Z);
+}
+
+void LightClusters::build_boxes(float fovY, float _aspect) {
+    tanY = std::tan(glm::radians(fovY) * 0.5f);
+    aspect = _aspect;
+    float tanX = tanY * aspect;
+    boxMin.resize(DIM_X * DIM_Y * DIM_Z);
+    boxMax.resize(DIM_X * DIM_Y * DIM_Z);
+    for (unsigned int z = 0; z < DIM_Z; z++) {
+        float depths[2] = {slice_depth(z), slice_depth(z + 1)};
+        for (unsigned int y = 0; y < DIM_Y; y++) {
+            for (unsigned int x = 0; x < DIM_X; x++) {
+                float ndcX[2] = {-1.0f + 2.0f * (float) x / DIM_X, -1.0f + 2.0f * (float) (x + 1) / DIM_X};
+                float ndcY[2] = {-1.0f + 2.0f * (float) y / DIM_Y, -1.0f + 2.0f * (float) (y + 1) / DIM_Y};
+                glm::vec3 lo(INFINITY), hi(-INFINITY);
+                for (float depth : depths) {
+                    for (float nx : ndcX) {
+                        for (float ny : ndcY) {
+                            glm::vec3 corner(nx * depth * tanX, ny * depth * tanY, -depth);
+                            lo = glm::min(lo, corner);
+                            hi = glm::max(hi, corner);
+                        }
+                    }
+                }
+                unsigned int index = (z * DIM_Y + y) * DIM_X + x;
+                boxMin[index] = lo;
+                boxMax[index] = hi;
+            }
+        }
+    }
+}
+
+void LightClusters::update(const std::vector<ClusterLight> &lights, const glm::mat4 &view, float fovY, float _aspect) {
+    if (std::tan(glm::radians(fovY) * 0.5f) != tanY || _aspect != aspect)
+        build_boxes(fovY, _aspect);
+    float tanX = tanY * aspect;
+    lightCount = (unsigned int) lights.size();
+
+    pairs.clear();
+    for (unsigned int i = 0; i < lights.size() && i < 0xffff; i++) {
+        const ClusterLight &light = lights[i];
+        float range = light.positionRange.w;
+        glm::vec3 position = glm::vec3(view * glm::vec4(glm::vec3(light.positionRange), 1.0f));
+        glm::vec3 direction = glm::vec3(view * glm::vec4(glm::vec3(light.directionInner), 0.0f));
+        bool spot = light.colorType.w > 0.5f;
+        float cosOuter = light.attenuationOuter.w;
+
+        // bounding sphere of the lit volume: the range sphere, or the cone's spherical sector
+        glm::vec3 center = position;
+        float radius = range;
+        if (spot)
+            spot_bounding_sphere(position, direction, range, cosOuter, center, radius);
+
+        // candidate slices from the sphere's depth extent
+        float zNear = -center.z - radius, zFar = -center.z + radius;
+        if (zFar < near || zNear > far)
+            continue;
+        zNear = glm::max(zNear, near);
+        zFar = glm::min(zFar, far);
+        int z0 = (int) std::floor(std::log(zNear / near) / std::log(far / near) * DIM_Z);
+        int z1 = (int) std::floor(std::log(zFar / near) / std::log(far / near) * DIM_Z);
+        z0 = glm::clamp(z0, 0, (int) DIM_Z - 1);
+        z1 = glm::clamp(z1, 0, (int) DIM_Z - 1);
+
+        // candidate tiles from the sphere's x/y extent at both ends of that depth range
+        float ndc[4] = {INFINITY, -INFINITY, INFINITY, -INFINITY};
+        for (float depth : {zNear, zFar}) {
+            for (float dx : {-radius, radius}) {
+                float nx = (center.x + dx) / (depth * tanX);
+                ndc[0] = glm::min(ndc[0], nx);
+                ndc[1] = glm::max(ndc[1], nx);
+            }
+            for (float dy : {-radius, radius}) {
+                float ny = (center.y + dy) / (depth * tanY);
+                ndc[2] = glm::min(ndc[2], ny);
+                ndc[3] = glm::max(ndc[3], ny);
+            }
+        }
+        int x0 = glm::clamp((int) std::floor((ndc[0] + 1.0f) * 0.5f * DIM_X), 0, (int) DIM_X - 1);
+        int x1 = glm::clamp((int) std::floor((ndc[1] + 1.0f) * 0.5f * DIM_X), 0, (int) DIM_X - 1);
+        int y0 = glm::clamp((int) std::floor((ndc[2] + 1.0f) * 0.5f * DIM_Y), 0, (int) DIM_Y - 1);
+        int y1 = glm::clamp((int) std::floor((ndc[3] + 1.0f) * 0.5f * DIM_Y), 0, (int) DIM_Y - 1);
+        if (ndc[1] < -1.0f || ndc[0] > 1.0f || ndc[3] < -1.0f || ndc[2] > 1.0f)
+            continue;
+
+        for (int z = z0; z <= z1; z++) {
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    unsigned int index = (z * DIM_Y + y) * DIM_X + x;
+                    // sphere against the cluster box
+                    glm::vec3 closest = glm::clamp(center, boxMin[index], boxMax[index]);
+                    glm::vec3 offset = closest - center;
+                    if (glm::dot(offset, offset) > radius * radius)
+                        continue;
+                    if (spot) {
+                        // cluster bounding sphere against the cone
+                        glm::vec3 boxCenter = (boxMin[index] + boxMax[index]) * 0.5f;
+                        float boxRadius = glm::length(boxMax[index] - boxCenter);
+                        if (!sphere_intersects_cone(position, direction, range, cosOuter, boxCenter, boxRadius))
+                            continue;
+                    }
+                    pairs.push_back(index << 16 | i);
+                }
+            }
+        }
+    }
+
+    // counting sort of the pairs into compact per-cluster lists
+    grid.assign(DIM_X * DIM_Y * DIM_Z * 2, 0);
+    for (unsigned int pair : pairs)
+        grid[(pair >> 16) * 2 + 1]++;
+    unsigned int offset = 0;
+    for (unsigned int cluster = 0; cluster < DIM_X * DIM_Y * DIM_Z; cluster++) {
+        grid[cluster * 2] = offset;
+        offset += grid[cluster * 2 + 1];
+        grid[cluster * 2 + 1] = 0;
+    }
+    indices.resize(pairs.size());
+    for (unsigned int pair : pairs) {
+        unsigned int cluster = pair >> 16;
+        indices[grid[cluster * 2] + grid[cluster * 2 + 1]++] = pair & 0xffff;
+    }
+
+    // orphan and refill the buffers, sized to at least one element
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(lights.size(), 1) * sizeof(ClusterLight), nullptr, GL_STREAM_DRAW);
+    if (!lights.empty())
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, lights.size() * sizeof(ClusterLight), &lights[0]);
+    glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, grid.size() * sizeof(unsigned int), &grid[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(indices.size(), 1) * sizeof(unsigned int), nullptr, GL_STREAM_DRAW);
+    if (!indices.empty())
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, indices.size() * sizeof(unsigned int), &indices[0]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bind(Shader &shader, int firstUnit) const {
+    const unsigned int textures[3] = {lightTexture, gridTexture, indexTexture};
+    const char *names[3] = {"eventLightData", "clusterGrid", "clusterLights"};
+    for (int i = 0; i < 3; i++) {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        shader.setInt(names[i], firstUnit + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    shader.setInt("numEventLights", (int) lightCount);
+    shader.setFloat("clusterNear", near);
+    shader.setFloat("clusterFar", far);
+}
+
+#endif //PROJECT_BASE_CLUSTERS_HPP
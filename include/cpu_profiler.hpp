@@ -0,0 +1,187 @@
+#ifndef PROJECT_BASE_CPU_PROFILER_HPP
+#define PROJECT_BASE_CPU_PROFILER_HPP
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <allocations.hpp>
+
+// Named CPU zones, recorded by the threads that run them and exported in the
+// Chrome Trace Event format (chrome://tracing, Perfetto). Every thread writes
+// into a ring of its own, so recording takes no locks; a new thread links its
+// ring into the profiler with a compare and swap. Each ring keeps the latest
+// events, the oldest are overwritten once it is full. Zones also count the heap
+// allocations made while they ran, nested zones included.
+class CpuProfiler {
+public:
+    explicit CpuProfiler(unsigned int _capacity = 1 << 16);
+    ~CpuProfiler();
+    CpuProfiler(const CpuProfiler &) = delete;
+    CpuProfiler &operator=(const CpuProfiler &) = delete;
+
+    // name must outlive the profiler, e.g. a string literal
+    void record(const char *name, uint64_t start, uint64_t end, const AllocationCounts &allocations = {0, 0});
+    // the events of every thread, which should not be recording meanwhile
+    void write_chrome_trace(std::ostream &out) const;
+    struct ZoneTotal {
+        double milliseconds;
+        unsigned long long calls;
+        unsigned long long allocations;
+        unsigned long long allocatedBytes;
+    };
+    // every zone that started at or after since, over all threads, as far back
+    // as the rings reach
+    std::map<std::string, ZoneTotal> zone_totals(uint64_t since) const;
+    // nanoseconds of a monotonic clock
+    static uint64_t now();
+
+private:
+    struct Event {
+        const char *name;
+        uint64_t start;
+        uint64_t end;
+        AllocationCounts allocations;
+    };
+    struct ThreadBuffer {
+        unsigned int thread;
+        std::vector<Event> events;
+        std::atomic<uint64_t> recorded; // events ever recorded, the ring index wraps around
+        ThreadBuffer *next;
+    };
+
+    unsigned int capacity;
+    std::atomic<ThreadBuffer *> buffers;
+    std::atomic<unsigned int> threads;
+
+    ThreadBuffer &thread_buffer();
+};
+
+CpuProfiler::CpuProfiler(unsigned int _capacity) :
+    capacity(_capacity),
+    buffers(nullptr),
+    threads(0) {
+}
+
+CpuProfiler::~CpuProfiler() {
+    ThreadBuffer *buffer = buffers.load();
+    while (buffer) {
+        ThreadBuffer *next = buffer->next;
+        delete buffer;
+        buffer = next;
+    }
+}
+
+uint64_t CpuProfiler::now() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CpuProfiler::ThreadBuffer &CpuProfiler::thread_buffer() {
+    // the ring of this thread, for the profiler it was made for
+    thread_local const CpuProfiler *owner = nullptr;
+    thread_local ThreadBuffer *cached = nullptr;
+    if (owner == this)
+        return *cached;
+    ThreadBuffer *buffer = new ThreadBuffer;
+    buffer->thread = threads.fetch_add(1);
+    buffer->events.resize(capacity);
+    buffer->recorded.store(0);
+    buffer->next = buffers.load(std::memory_order_relaxed);
+    while (!buffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed));
+    owner = this;
+    cached = buffer;
+    return *buffer;
+}
+
+void CpuProfiler::record(const char *name, uint64_t start, uint64_t end, const AllocationCounts &allocations) {
+    ThreadBuffer &buffer = thread_buffer();
+    uint64_t index = buffer.recorded.load(std::memory_order_relaxed);
+    buffer.events[index % capacity] = {name, start, end, allocations};
+    // publishes the event to write_chrome_trace
+    buffer.recorded.store(index + 1, std::memory_order_release);
+}
+
+void CpuProfiler::write_chrome_trace(std::ostream &out) const {
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    uint64_t origin = UINT64_MAX;
+    for (ThreadBuffer *buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+        uint64_t recorded = buffer->recorded.load(std::memory_order_acquire);
+        for (uint64_t i = recorded > capacity ? recorded - capacity : 0; i < recorded; i++)
+            origin = std::min(origin, buffer->events[i % capacity].start);
+    }
+    for (ThreadBuffer *buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+        out << fmt::format("{}{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, \"args\": {{\"name\": \"{}\"}}}}",
+                           first ? "" : ",\n", buffer->thread, buffer->thread == 0 ? "main" : fmt::format("thread {}", buffer->thread));
+        first = false;
+        uint64_t recorded = buffer->recorded.load(std::memory_order_acquire);
+        for (uint64_t i = recorded > capacity ? recorded - capacity : 0; i < recorded; i++) {
+            const Event &event = buffer->events[i % capacity];
+            // microseconds, relative to the oldest event kept
+            out << fmt::format(",\n{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}{}}}",
+                               event.name, buffer->thread, (double) (event.start - origin) * 1e-3, (double) (event.end - event.start) * 1e-3,
+                               event.allocations.allocations == 0 ? "" : fmt::format(", \"args\": {{\"allocations\": {}, \"bytes\": {}}}",
+                                                                                      event.allocations.allocations, event.allocations.bytes));
+        }
+    }
+    out << "\n]}\n";
+}
+
+std::map<std::string, CpuProfiler::ZoneTotal> CpuProfiler::zone_totals(uint64_t since) const {
+    std::map<std::string, ZoneTotal> totals;
+    for (ThreadBuffer *buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+        uint64_t recorded = buffer->recorded.load(std::memory_order_acquire);
+        for (uint64_t i = recorded > capacity ? recorded - capacity : 0; i < recorded; i++) {
+            const Event &event = buffer->events[i % capacity];
+            if (event.start < since)
+                continue;
+            ZoneTotal &total = totals[event.name];
+            total.milliseconds += (double) (event.end - event.start) * 1e-6;
+            total.calls++;
+            total.allocations += event.allocations.allocations;
+            total.allocatedBytes += event.allocations.bytes;
+        }
+    }
+    return totals;
+}
+
+// Records the scope it lives in as a zone.
+class CpuZone {
+public:
+    CpuZone(CpuProfiler &_profiler, const char *_name);
+    ~CpuZone();
+    CpuZone(const CpuZone &) = delete;
+    CpuZone &operator=(const CpuZone &) = delete;
+
+private:
+    CpuProfiler &profiler;
+    const char *name;
+    const char *outerZone;
+    AllocationCounts startAllocations;
+    uint64_t start;
+};
+
+CpuZone::CpuZone(CpuProfiler &_profiler, const char *_name) :
+    profiler(_profiler),
+    name(_name),
+    outerZone(thread_allocation_check().zone),
+    startAllocations(thread_allocations()),
+    start(CpuProfiler::now()) {
+    thread_allocation_check().zone = name;
+}
+
+CpuZone::~CpuZone() {
+    uint64_t end = CpuProfiler::now();
+    AllocationCounts allocations = thread_allocations().since(startAllocations);
+    thread_allocation_check().zone = outerZone;
+    profiler.record(name, start, end, allocations);
+}
+
+#endif //PROJECT_BASE_CPU_PROFILER_HPP
@@ -0,0 +1,131 @@
+#ifndef PROJECT_BASE_FRAME_ARENA_HPP
+#define PROJECT_BASE_FRAME_ARENA_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// Scratch memory of the render loop: allocating bumps a pointer, freeing does
+// nothing, and everything goes at once when the frame ends. It is double
+// buffered, begin_frame resets the half used two frames ago, so what a frame
+// allocated stays valid through the next one, e.g. while the GPU may still
+// read it. What doesn't fit goes to the heap and the half grows to the frame's
+// need when it is reset next, so after the first frames of a scene nothing
+// reaches the heap.
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity);
+    ~FrameArena();
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    void begin_frame();
+    // alignment up to alignof(std::max_align_t)
+    void *allocate(size_t bytes, size_t alignment);
+
+    size_t used() const { return halves[current].requested; } // by the current frame
+    size_t capacity() const { return halves[0].capacity + halves[1].capacity; }
+    size_t peak() const { return peakBytes; } // most any frame used
+    unsigned long long overflows; // allocations that went to the heap
+
+private:
+    // heap blocks of allocations that didn't fit, freed with their half
+    struct Overflow {
+        Overflow *next;
+    };
+    static const size_t OVERFLOW_HEADER = alignof(std::max_align_t);
+
+    struct Half {
+        char *memory;
+        size_t capacity;
+        size_t offset;
+        size_t requested; // bytes asked for, including the overflow
+        Overflow *overflow;
+    };
+    Half halves[2];
+    unsigned int current;
+    size_t peakBytes;
+};
+
+FrameArena::FrameArena(size_t capacity) : overflows(0), current(0), peakBytes(0) {
+    for (Half &half : halves)
+        half = Half{static_cast<char *>(::operator new(capacity)), capacity, 0, 0, nullptr};
+}
+
+FrameArena::~FrameArena() {
+    for (Half &half : halves) {
+        while (half.overflow) {
+            Overflow *next = half.overflow->next;
+            ::operator delete(half.overflow);
+            half.overflow = next;
+        }
+        ::operator delete(half.memory);
+    }
+}
+
+void FrameArena::begin_frame() {
+    current ^= 1;
+    Half &half = halves[current];
+    while (half.overflow) {
+        Overflow *next = half.overflow->next;
+        ::operator delete(half.overflow);
+        half.overflow = next;
+    }
+    if (half.requested > half.capacity) {
+        ::operator delete(half.memory);
+        half.capacity = half.requested + half.requested / 2;
+        half.memory = static_cast<char *>(::operator new(half.capacity));
+    }
+    half.offset = 0;
+    half.requested = 0;
+}
+
+void *FrameArena::allocate(size_t bytes, size_t alignment) {
+    assert(alignment <= alignof(std::max_align_t));
+    Half &half = halves[current];
+    size_t start = (half.offset + alignment - 1) & ~(alignment - 1);
+    half.requested += start - half.offset + bytes;
+    peakBytes = std::max(peakBytes, half.requested);
+    if (start + bytes <= half.capacity) {
+        half.offset = start + bytes;
+        return half.memory + start;
+    }
+    overflows++;
+    Overflow *block = static_cast<Overflow *>(::operator new(OVERFLOW_HEADER + bytes));
+    block->next = half.overflow;
+    half.overflow = block;
+    return reinterpret_cast<char *>(block) + OVERFLOW_HEADER;
+}
+
+// Lets standard containers allocate from a FrameArena. Their memory is only
+// reclaimed with the arena's half, so containers that grow should reserve
+// what they need up front; the blocks they outgrow stay used until then.
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator(FrameArena &_arena) : arena(&_arena) {};
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {};
+
+    T *allocate(size_t n) { return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T *, size_t) {}
+
+    FrameArena *arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+// a vector of the frame, e.g. FrameVector<unsigned int> list(frameArena)
+template<typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif //PROJECT_BASE_FRAME_ARENA_HPP
@@ -0,0 +1,137 @@
+#ifndef PROJECT_BASE_FRAME_STATS_HPP
+#define PROJECT_BASE_FRAME_STATS_HPP
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Frame times in milliseconds. The latest frames are kept in a fixed ring for
+// percentiles; the histogram and the stutters count every frame since the
+// start. A stutter is a frame that takes more than twice the running average
+// of the frames before it, the hitches a mean frame rate hides.
+class FrameStats {
+public:
+    static const int BUCKETS = 10;
+    // upper bounds of the histogram buckets, the last one is open
+    static constexpr float BUCKET_LIMITS[BUCKETS - 1] = {4.0f, 8.0f, 12.0f, 16.7f, 20.0f, 25.0f, 33.3f, 50.0f, 100.0f};
+
+    explicit FrameStats(unsigned int _capacity = 8192);
+    void add(float seconds);
+
+    // over the latest frames, at most the capacity, all if frames is 0
+    unsigned int size() const { return filled; }
+    float mean(unsigned int frames = 0) const;
+    // p in [0, 100], nearest rank
+    float percentile(float p, unsigned int frames = 0) const;
+    // mean frame rate of the slowest percent of the frames
+    float one_percent_low_fps(unsigned int frames = 0) const;
+
+    unsigned long long total_frames() const { return totalFrames; }
+    unsigned long long stutters() const { return stutterCount; }
+    const unsigned long long *histogram() const { return buckets; }
+    void write_summary(std::ostream &out) const;
+
+private:
+    std::vector<float> times;
+    unsigned int head;
+    unsigned int filled;
+    float runningAverage;
+    unsigned long long totalFrames;
+    unsigned long long stutterCount;
+    unsigned long long buckets[BUCKETS];
+    mutable std::vector<float> scratch;
+
+    // the latest frames, in no particular order
+    const std::vector<float> &latest(unsigned int frames) const;
+};
+
+constexpr float FrameStats::BUCKET_LIMITS[];
+
+FrameStats::FrameStats(unsigned int _capacity) :
+    times(_capacity, 0.0f),
+    head(0),
+    filled(0),
+    runningAverage(0.0f),
+    totalFrames(0),
+    stutterCount(0) {
+    std::fill(buckets, buckets + BUCKETS, 0ull);
+    scratch.reserve(_capacity);
+}
+
+void FrameStats::add(float seconds) {
+    float milliseconds = seconds * 1000.0f;
+    times[head] = milliseconds;
+    head = (head + 1) % (unsigned int) times.size();
+    filled = std::min(filled + 1, (unsigned int) times.size());
+
+    // a few frames to settle first
+    if (totalFrames >= 8 && milliseconds > 2.0f * runningAverage)
+        stutterCount++;
+    runningAverage = totalFrames == 0 ? milliseconds : 0.95f * runningAverage + 0.05f * milliseconds;
+    totalFrames++;
+
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && milliseconds >= BUCKET_LIMITS[bucket])
+        bucket++;
+    buckets[bucket]++;
+}
+
+const std::vector<float> &FrameStats::latest(unsigned int frames) const {
+    unsigned int count = frames == 0 ? filled : std::min(frames, filled);
+    scratch.clear();
+    for (unsigned int i = 1; i <= count; i++)
+        scratch.push_back(times[(head + (unsigned int) times.size() - i) % times.size()]);
+    return scratch;
+}
+
+float FrameStats::mean(unsigned int frames) const {
+    const std::vector<float> &values = latest(frames);
+    if (values.empty())
+        return 0.0f;
+    float sum = 0.0f;
+    for (float value : values)
+        sum += value;
+    return sum / (float) values.size();
+}
+
+float FrameStats::percentile(float p, unsigned int frames) const {
+    latest(frames);
+    if (scratch.empty())
+        return 0.0f;
+    size_t rank = (size_t) std::min((double) scratch.size() - 1.0, std::max(0.0, std::ceil(p / 100.0 * (double) scratch.size()) - 1.0));
+    std::nth_element(scratch.begin(), scratch.begin() + (long) rank, scratch.end());
+    return scratch[rank];
+}
+
+float FrameStats::one_percent_low_fps(unsigned int frames) const {
+    latest(frames);
+    if (scratch.empty())
+        return 0.0f;
+    size_t slowest = std::max((size_t) 1, scratch.size() / 100);
+    std::nth_element(scratch.begin(), scratch.begin() + (long) slowest - 1, scratch.end(), std::greater<float>());
+    float sum = 0.0f;
+    for (size_t i = 0; i < slowest; i++)
+        sum += scratch[i];
+    return sum > 0.0f ? 1000.0f * (float) slowest / sum : 0.0f;
+}
+
+void FrameStats::write_summary(std::ostream &out) const {
+    out << fmt::format("Frame times over the last {} of {} frames: mean {:.2f} ms, p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms, 1% low {:.1f} FPS\n",
+                       filled, totalFrames, mean(), percentile(50.0f), percentile(95.0f), percentile(99.0f), percentile(100.0f), one_percent_low_fps());
+    out << fmt::format("Stutters (over twice the running average): {} ({:.2f}%)\n",
+                       stutterCount, totalFrames ? 100.0 * (double) stutterCount / (double) totalFrames : 0.0);
+    unsigned long long largest = *std::max_element(buckets, buckets + BUCKETS);
+    for (int i = 0; i < BUCKETS; i++) {
+        std::string range = i == BUCKETS - 1 ? fmt::format("{:>5.1f}+      ms", BUCKET_LIMITS[i - 1])
+                                             : fmt::format("{:>5.1f}-{:<5.1f} ms", i ? BUCKET_LIMITS[i - 1] : 0.0f, BUCKET_LIMITS[i]);
+        int bar = largest ? (int) (40 * buckets[i] / largest) : 0;
+        out << fmt::format("  {} {:>8}{}{}\n", range, buckets[i], bar ? " " : "", std::string((size_t) bar, '#'));
+    }
+}
+
+#endif //PROJECT_BASE_FRAME_STATS_HPP
@@ -0,0 +1,206 @@
+#ifndef PROJECT_BASE_FRUSTUM_CULLING_HPP
+#define PROJECT_BASE_FRUSTUM_CULLING_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <scene.hpp>
+
+// Six normalized planes, inside where dot(plane, (p, 1)) >= 0, extracted from a
+// view-projection matrix (Gribb & Hartmann).
+struct Frustum {
+    glm::vec4 planes[6];
+
+    explicit Frustum(const glm::mat4 &viewProjection);
+};
+
+Frustum::Frustum(const glm::mat4 &viewProjection) {
+    glm::mat4 m = glm::transpose(viewProjection);
+    planes[0] = m[3] + m[0]; // left
+    planes[1] = m[3] - m[0]; // right
+    planes[2] = m[3] + m[1]; // bottom
+    planes[3] = m[3] - m[1]; // top
+    planes[4] = m[3] + m[2]; // near
+    planes[5] = m[3] - m[2]; // far
+    for (glm::vec4 &plane : planes)
+        plane /= glm::length(glm::vec3(plane));
+}
+
+// drawn and culled meshes of one pass
+struct CullStats {
+    unsigned int drawn;
+    unsigned int culled;
+
+    CullStats() : drawn(0), culled(0) {};
+    void add(const CullStats &other) {
+        drawn += other.drawn;
+        culled += other.culled;
+    }
+};
+
+// Culls every mesh of every scene instance. The world space bounds are kept as
+// structure of arrays, so the per-plane loops over them have no branches and
+// compile to vector code. A mesh is kept if both its sphere and its box reach
+// into the frustum; the results stay valid until the next cull. Given the
+// scene, the instances are first narrowed down through its BVH and only the
+// meshes of those it returns are tested.
+class FrustumCuller {
+public:
+    // transforms the mesh bounds of the frame's instances
+    void set_instances(const std::vector<SceneInstance> &instances);
+    CullStats cull(const Frustum &frustum);
+    CullStats cull(const Frustum &frustum, const Scene &scene);
+    // for the six faces of a cube map at once: everything within range of the light
+    CullStats cull_sphere(glm::vec3 center, float radius);
+    CullStats cull_sphere(glm::vec3 center, float radius, const Scene &scene);
+    // keeps everything, culling disabled
+    CullStats keep_all();
+
+    bool instance_visible(unsigned int instance) const { return instanceVisible[instance] != 0; }
+    // one flag per mesh of the instance, in Model::meshes order
+    const uint8_t *mesh_visibility(unsigned int instance) const { return &visible[firstMesh[instance]]; }
+
+private:
+    std::vector<unsigned int> firstMesh;
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<float> extentX, extentY, extentZ; // box half sizes around the same center
+    std::vector<uint8_t> visible;
+    std::vector<uint8_t> instanceVisible;
+    std::vector<unsigned int> candidates; // instances the BVH returned
+
+    // test the meshes [begin, end)
+    void test_planes(const Frustum &frustum, size_t begin, size_t end);
+    void test_sphere(glm::vec3 center, float sphereRadius, size_t begin, size_t end);
+    // only the meshes of the candidates can be visible, test(begin, end) decides on those
+    template<typename Test>
+    void test_candidates(Test test);
+    size_t mesh_end(unsigned int instance) const {
+        return instance + 1 < firstMesh.size() ? firstMesh[instance + 1] : visible.size();
+    }
+    CullStats finish();
+};
+
+void FrustumCuller::set_instances(const std::vector<SceneInstance> &instances) {
+    firstMesh.clear();
+    centerX.clear(); centerY.clear(); centerZ.clear(); radius.clear();
+    extentX.clear(); extentY.clear(); extentZ.clear();
+    for (const SceneInstance &instance : instances) {
+        firstMesh.push_back((unsigned int) centerX.size());
+        const glm::mat4 &m = instance.transform;
+        float scale = glm::max(glm::length(glm::vec3(m[0])), glm::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+        for (const Mesh &mesh : instance.model->meshes) {
+            glm::vec3 center = glm::vec3(m * glm::vec4(mesh.boundsCenter, 1.0f));
+            // the box around the transformed box
+            glm::vec3 halfSize = 0.5f * (mesh.boundsMax - mesh.boundsMin);
+            glm::vec3 extent = glm::abs(glm::vec3(m[0])) * halfSize.x + glm::abs(glm::vec3(m[1])) * halfSize.y + glm::abs(glm::vec3(m[2])) * halfSize.z;
+            centerX.push_back(center.x);
+            centerY.push_back(center.y);
+            centerZ.push_back(center.z);
+            radius.push_back(mesh.boundsRadius * scale);
+            extentX.push_back(extent.x);
+            extentY.push_back(extent.y);
+            extentZ.push_back(extent.z);
+        }
+    }
+    visible.assign(centerX.size(), 1);
+    instanceVisible.assign(instances.size(), 1);
+}
+
+CullStats FrustumCuller::cull(const Frustum &frustum) {
+    test_planes(frustum, 0, visible.size());
+    return finish();
+}
+
+CullStats FrustumCuller::cull(const Frustum &frustum, const Scene &scene) {
+    candidates.clear();
+    scene.query_frustum(frustum.planes, candidates);
+    test_candidates([&](size_t begin, size_t end) { test_planes(frustum, begin, end); });
+    return finish();
+}
+
+CullStats FrustumCuller::cull_sphere(glm::vec3 center, float sphereRadius) {
+    test_sphere(center, sphereRadius, 0, visible.size());
+    return finish();
+}
+
+CullStats FrustumCuller::cull_sphere(glm::vec3 center, float sphereRadius, const Scene &scene) {
+    candidates.clear();
+    scene.query_sphere(center, sphereRadius, candidates);
+    test_candidates([&](size_t begin, size_t end) { test_sphere(center, sphereRadius, begin, end); });
+    return finish();
+}
+
+void FrustumCuller::test_planes(const Frustum &frustum, size_t begin, size_t end) {
+    std::fill(visible.begin() + begin, visible.begin() + end, 1);
+    for (const glm::vec4 &plane : frustum.planes) {
+        float nx = plane.x, ny = plane.y, nz = plane.z, w = plane.w;
+        float ax = std::fabs(nx), ay = std::fabs(ny), az = std::fabs(nz);
+        for (size_t i = begin; i < end; i++) {
+            float distance = nx * centerX[i] + ny * centerY[i] + nz * centerZ[i] + w;
+            float boxReach = ax * extentX[i] + ay * extentY[i] + az * extentZ[i];
+            float reach = radius[i] < boxReach ? radius[i] : boxReach; // minps, unlike fmin
+            visible[i] &= (uint8_t) (distance + reach >= 0.0f);
+        }
+    }
+}
+
+void FrustumCuller::test_sphere(glm::vec3 center, float sphereRadius, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        float dx = centerX[i] - center.x, dy = centerY[i] - center.y, dz = centerZ[i] - center.z;
+        float reach = sphereRadius + radius[i];
+        visible[i] = (uint8_t) (dx * dx + dy * dy + dz * dz <= reach * reach);
+    }
+}
+
+template<typename Test>
+void FrustumCuller::test_candidates(Test test) {
+    std::fill(visible.begin(), visible.end(), 0);
+    for (unsigned int instance : candidates)
+        test(firstMesh[instance], mesh_end(instance));
+}
+
+CullStats FrustumCuller::keep_all() {
+    std::fill(visible.begin(), visible.end(), 1);
+    return finish();
+}
+
+CullStats FrustumCuller::finish() {
+    CullStats stats;
+    for (unsigned int instance = 0; instance < firstMesh.size(); instance++) {
+        size_t end = mesh_end(instance);
+        uint8_t any = 0;
+        for (size_t i = firstMesh[instance]; i < end; i++)
+            any |= visible[i];
+        instanceVisible[instance] = any;
+    }
+    for (uint8_t flag : visible) {
+        stats.drawn += flag;
+        stats.culled += 1 - flag;
+    }
+    return stats;
+}
+
+// The instances the culler kept, with the squared distance from the eye to their
+// bounds, nearest first: drawn in this order, early depth testing rejects more
+// of what lies behind. Any allocator, e.g. a FrameVector of the frame arena.
+template<typename Allocator>
+void front_to_back(const std::vector<SceneInstance> &instances, const FrustumCuller &culler, glm::vec3 eye,
+                   std::vector<std::pair<float, unsigned int>, Allocator> &drawList) {
+    drawList.clear();
+    drawList.reserve(instances.size());
+    for (unsigned int i = 0; i < instances.size(); i++) {
+        if (!culler.instance_visible(i))
+            continue;
+        glm::vec3 closest = glm::clamp(eye, instances[i].boundsMin, instances[i].boundsMax);
+        glm::vec3 offset = eye - closest;
+        drawList.emplace_back(glm::dot(offset, offset), i);
+    }
+    std::sort(drawList.begin(), drawList.end());
+}
+
+#endif //PROJECT_BASE_FRUSTUM_CULLING_HPP
@@ -0,0 +1,111 @@
+#ifndef PROJECT_BASE_GBUFFER_HPP
+#define PROJECT_BASE_GBUFFER_HPP
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+#include <learnopengl/shader.h>
+
+// Render pipelines, selectable at runtime. Both shade with lighting.glsl.
+enum RenderPipeline {
+    RENDER_PIPELINE_FORWARD = 0,
+    RENDER_PIPELINE_DEFERRED,
+    RENDER_PIPELINE_COUNT
+};
+
+inline const char *render_pipeline_name(RenderPipeline pipeline) {
+    switch (pipeline) {
+        case RENDER_PIPELINE_FORWARD: return "forward";
+        case RENDER_PIPELINE_DEFERRED: return "deferred";
+        default: return "unknown";
+    }
+}
+
+inline RenderPipeline next_render_pipeline(RenderPipeline pipeline) {
+    return (RenderPipeline) ((pipeline + 1) % RENDER_PIPELINE_COUNT);
+}
+
+// Geometry buffer of the deferred pipeline, 12 bytes per pixel:
+//   RGBA8  albedo, specular intensity in alpha
+//   RG16   octahedral encoded normal
+//   DEPTH24 depth, world positions are reconstructed from it
+// Layout must match gbuffer.glsl.
+class GBuffer {
+public:
+    unsigned int FBO;
+    unsigned int albedoSpec;
+    unsigned int normal;
+    unsigned int depth;
+    int width;
+    int height;
+
+    GBuffer(int _width, int _height);
+    // reallocates the attachments if the size changed
+    void resize(int _width, int _height);
+    // binds the attachments to units firstUnit..firstUnit+2 and sets the samplers
+    void bind_textures(Shader &shader, int firstUnit) const;
+    size_t bytes() const { return (size_t) width * height * 12; }
+
+private:
+    void allocate();
+};
+
+GBuffer::GBuffer(int _width, int _height) :
+    width(_width),
+    height(_height) {
+
+    glGenFramebuffers(1, &FBO);
+    unsigned int textures[3];
+    glGenTextures(3, textures);
+    albedoSpec = textures[0];
+    normal = textures[1];
+    depth = textures[2];
+    for (unsigned int texture : textures) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    allocate();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoSpec, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normal, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+    const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GBuffer::allocate() {
+    glBindTexture(GL_TEXTURE_2D, albedoSpec);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, normal);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, width, height, 0, GL_RG, GL_UNSIGNED_SHORT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, depth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GBuffer::resize(int _width, int _height) {
+    if (_width == width && _height == height)
+        return;
+    width = _width;
+    height = _height;
+    allocate();
+}
+
+void GBuffer::bind_textures(Shader &shader, int firstUnit) const {
+    const unsigned int textures[3] = {albedoSpec, normal, depth};
+    const char *names[3] = {"gAlbedoSpec", "gNormal", "gDepth"};
+    for (int i = 0; i < 3; i++) {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        shader.setInt(names[i], firstUnit + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+#endif //PROJECT_BASE_GBUFFER_HPP
@@ -0,0 +1,382 @@
+#ifndef PROJECT_BASE_GPU_QUERIES_HPP
+#define PROJECT_BASE_GPU_QUERIES_HPP
+
+#include <glad/glad.h>
+#include <fmt/core.h>
+
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// GL_ARB_pipeline_statistics_query, core only since 4.6, so glad's 3.3 profile
+// doesn't define its tokens
+#ifndef GL_VERTICES_SUBMITTED_ARB
+#define GL_VERTICES_SUBMITTED_ARB                 0x82EE
+#define GL_PRIMITIVES_SUBMITTED_ARB               0x82EF
+#define GL_VERTEX_SHADER_INVOCATIONS_ARB          0x82F0
+#define GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED_ARB 0x82F3
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB        0x82F4
+#define GL_CLIPPING_INPUT_PRIMITIVES_ARB          0x82F6
+#define GL_CLIPPING_OUTPUT_PRIMITIVES_ARB         0x82F7
+#endif
+#ifndef GL_GEOMETRY_SHADER_INVOCATIONS
+#define GL_GEOMETRY_SHADER_INVOCATIONS            0x887F
+#endif
+
+// looked up in the current context's extension list
+inline bool gl_has_extension(const char *name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char *extension = (const char *) glGetStringi(GL_EXTENSIONS, (GLuint) i);
+        if (extension && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Counters of GL_ARB_pipeline_statistics_query, in the order the pipeline
+// reaches them. The tessellation and compute counters are left out, nothing
+// here uses those stages.
+enum PipelineStatistic {
+    PIPELINE_STATISTIC_VERTICES,
+    PIPELINE_STATISTIC_PRIMITIVES,
+    PIPELINE_STATISTIC_VERTEX_SHADER,
+    PIPELINE_STATISTIC_GEOMETRY_SHADER,
+    PIPELINE_STATISTIC_GEOMETRY_PRIMITIVES,
+    PIPELINE_STATISTIC_CLIPPING_INPUT,
+    PIPELINE_STATISTIC_CLIPPING_OUTPUT,
+    PIPELINE_STATISTIC_FRAGMENT_SHADER,
+    PIPELINE_STATISTIC_COUNT
+};
+
+inline GLenum pipeline_statistic_target(PipelineStatistic statistic) {
+    const GLenum targets[PIPELINE_STATISTIC_COUNT] = {
+        GL_VERTICES_SUBMITTED_ARB, GL_PRIMITIVES_SUBMITTED_ARB, GL_VERTEX_SHADER_INVOCATIONS_ARB,
+        GL_GEOMETRY_SHADER_INVOCATIONS, GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED_ARB,
+        GL_CLIPPING_INPUT_PRIMITIVES_ARB, GL_CLIPPING_OUTPUT_PRIMITIVES_ARB, GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+    };
+    return targets[statistic];
+}
+
+inline const char *pipeline_statistic_name(PipelineStatistic statistic) {
+    const char *names[PIPELINE_STATISTIC_COUNT] = {
+        "vertices", "primitives", "vs invocations", "gs invocations", "gs primitives",
+        "clip in", "clip out", "fs invocations"
+    };
+    return names[statistic];
+}
+
+typedef std::array<GLuint64, PIPELINE_STATISTIC_COUNT> PipelineCounts;
+
+// Ring of GL queries of one target, read back a few frames late so the CPU
+// never waits for the GPU. If results are not collected, the oldest query is
+// dropped when the ring wraps around.
+class QueryRing {
+public:
+    explicit QueryRing(GLenum _target, unsigned int _size = 4);
+    void begin();
+    void end();
+    // result of the oldest finished query, false while none is available
+    bool result(GLuint64 &value);
+
+private:
+    GLenum target;
+    std::vector<unsigned int> queries;
+    unsigned int head;    // next query to begin
+    unsigned int pending; // ended but not read back
+};
+
+QueryRing::QueryRing(GLenum _target, unsigned int _size) :
+    target(_target),
+    queries(_size),
+    head(0),
+    pending(0) {
+    glGenQueries((GLsizei) queries.size(), &queries[0]);
+}
+
+void QueryRing::begin() {
+    if (pending == queries.size())
+        pending--;
+    glBeginQuery(target, queries[head]);
+}
+
+void QueryRing::end() {
+    glEndQuery(target);
+    head = (head + 1) % (unsigned int) queries.size();
+    pending++;
+}
+
+bool QueryRing::result(GLuint64 &value) {
+    if (pending == 0)
+        return false;
+    unsigned int oldest = (head + (unsigned int) queries.size() - pending) % (unsigned int) queries.size();
+    GLint available = 0;
+    glGetQueryObjectiv(queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return false;
+    glGetQueryObjectui64v(queries[oldest], GL_QUERY_RESULT, &value);
+    pending--;
+    return true;
+}
+
+// GPU time of named render passes, from GL_TIME_ELAPSED queries. The queries
+// of a frame are kept in a ring of frames and read back only once all of them
+// are available, a few frames later, so profiling never stalls the pipeline.
+// Every pass keeps a rolling average over the last frames read back; a pass
+// missing from a frame counts as zero, so the averages are per frame costs.
+// Passes must not nest, GL has a single time elapsed query at a time.
+// With statistics on, every pass also counts the pipeline statistics of
+// GL_ARB_pipeline_statistics_query, kept for the last frame read back.
+class GpuProfiler {
+public:
+    bool enabled;
+    bool statistics;
+
+    explicit GpuProfiler(unsigned int _frames = 4, unsigned int _window = 60);
+    // turns the statistics on, with the profiler; false if the context lacks the extension
+    bool set_statistics(bool on);
+    // reads back the finished frames, then starts recording this one
+    void begin_frame();
+    void begin(const char *pass);
+    void end();
+    // waits for the GPU and reads back every frame, e.g. before reporting
+    void finish();
+
+    unsigned int passes() const { return (unsigned int) names.size(); }
+    const std::string &pass_name(unsigned int pass) const { return names[pass]; }
+    // rolling average in milliseconds
+    float average(unsigned int pass) const;
+    float total_average() const;
+    // e.g. "3.20 ms GPU (scene 2.10, shadow 0 0.80, ...)", written up to end
+    // without allocating, returns where it stopped
+    char *summary(char *out, char *end) const;
+    // every frame read back from now on adds frame,pass,milliseconds rows
+    void write_csv(std::ostream *_csv);
+    // pipeline statistics of the pass in the last frame read back, zero while off
+    const PipelineCounts &pass_statistics(unsigned int pass) const { return counts[pass]; }
+    // a table of the passes' statistics; pixels of the framebuffer, for the fragments per pixel
+    void write_statistics(std::ostream &out, double pixels) const;
+
+private:
+    struct Timing {
+        unsigned int pass;
+        unsigned int query;
+        int firstStatistic; // into Frame::statisticQueries, -1 without statistics
+    };
+    struct Frame {
+        unsigned int number;
+        bool pending;
+        std::vector<Timing> timings;
+        std::vector<unsigned int> queries; // reused from frame to frame
+        std::vector<unsigned int> statisticQueries;
+        unsigned int statisticsUsed;
+    };
+
+    std::vector<Frame> frames;
+    unsigned int head; // frame being recorded
+    unsigned int frameNumber;
+    bool recording;
+    unsigned int window;
+    unsigned int samples; // frames read back, up to the window
+    std::vector<std::string> names;
+    std::vector<std::vector<float>> history; // window milliseconds per pass
+    std::vector<PipelineCounts> counts;
+    int statisticsSupported; // -1 until the first set_statistics asks the context
+    std::ostream *csv;
+
+    bool collect(Frame &frame);
+    void collect_finished();
+};
+
+GpuProfiler::GpuProfiler(unsigned int _frames, unsigned int _window) :
+    enabled(false),
+    statistics(false),
+    frames(_frames),
+    head(0),
+    frameNumber(0),
+    recording(false),
+    window(_window),
+    samples(0),
+    statisticsSupported(-1),
+    csv(nullptr) {
+    for (Frame &frame : frames) {
+        frame.pending = false;
+        frame.statisticsUsed = 0;
+    }
+}
+
+bool GpuProfiler::set_statistics(bool on) {
+    if (on && statisticsSupported < 0)
+        statisticsSupported = gl_has_extension("GL_ARB_pipeline_statistics_query") ? 1 : 0;
+    statistics = on && statisticsSupported == 1;
+    if (statistics)
+        enabled = true;
+    return statistics == on;
+}
+
+void GpuProfiler::collect_finished() {
+    // oldest first, so the averages see the frames in order
+    for (unsigned int i = 1; i <= frames.size(); i++) {
+        Frame &frame = frames[(head + i) % frames.size()];
+        if (frame.pending && !collect(frame))
+            break;
+    }
+}
+
+void GpuProfiler::begin_frame() {
+    recording = false;
+    collect_finished();
+    if (!enabled)
+        return;
+    head = (head + 1) % (unsigned int) frames.size();
+    Frame &frame = frames[head];
+    // the ring wrapped around with the GPU this far behind, drop the oldest
+    frame.pending = false;
+    frame.timings.clear();
+    frame.statisticsUsed = 0;
+    frame.number = frameNumber++;
+    recording = true;
+}
+
+void GpuProfiler::begin(const char *pass) {
+    if (!recording)
+        return;
+    unsigned int index = 0;
+    while (index < names.size() && names[index] != pass)
+        index++;
+    if (index == names.size()) {
+        names.push_back(pass);
+        history.emplace_back(window, 0.0f);
+        counts.push_back(PipelineCounts());
+        counts.back().fill(0);
+    }
+    Frame &frame = frames[head];
+    if (frame.timings.size() == frame.queries.size()) {
+        unsigned int query;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+    unsigned int query = frame.queries[frame.timings.size()];
+    int firstStatistic = -1;
+    if (statistics) {
+        if (frame.statisticsUsed == frame.statisticQueries.size()) {
+            frame.statisticQueries.resize(frame.statisticsUsed + PIPELINE_STATISTIC_COUNT);
+            glGenQueries(PIPELINE_STATISTIC_COUNT, &frame.statisticQueries[frame.statisticsUsed]);
+        }
+        firstStatistic = (int) frame.statisticsUsed;
+        frame.statisticsUsed += PIPELINE_STATISTIC_COUNT;
+        for (int i = 0; i < PIPELINE_STATISTIC_COUNT; i++)
+            glBeginQuery(pipeline_statistic_target((PipelineStatistic) i), frame.statisticQueries[firstStatistic + i]);
+    }
+    frame.timings.push_back({index, query, firstStatistic});
+    frame.pending = true;
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void GpuProfiler::end() {
+    if (!recording)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    if (frames[head].timings.back().firstStatistic >= 0) {
+        for (int i = 0; i < PIPELINE_STATISTIC_COUNT; i++)
+            glEndQuery(pipeline_statistic_target((PipelineStatistic) i));
+    }
+}
+
+void GpuProfiler::finish() {
+    recording = false;
+    glFinish();
+    collect_finished();
+}
+
+bool GpuProfiler::collect(Frame &frame) {
+    for (const Timing &timing : frame.timings) {
+        GLint available = 0;
+        glGetQueryObjectiv(timing.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+        for (int i = 0; timing.firstStatistic >= 0 && i < PIPELINE_STATISTIC_COUNT; i++) {
+            glGetQueryObjectiv(frame.statisticQueries[timing.firstStatistic + i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return false;
+        }
+    }
+    unsigned int slot = samples % window;
+    for (std::vector<float> &passHistory : history)
+        passHistory[slot] = 0.0f;
+    for (PipelineCounts &passCounts : counts)
+        passCounts.fill(0);
+    for (const Timing &timing : frame.timings) {
+        if (timing.firstStatistic >= 0) {
+            for (int i = 0; i < PIPELINE_STATISTIC_COUNT; i++) {
+                GLuint64 count = 0;
+                glGetQueryObjectui64v(frame.statisticQueries[timing.firstStatistic + i], GL_QUERY_RESULT, &count);
+                counts[timing.pass][i] += count;
+            }
+        }
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(timing.query, GL_QUERY_RESULT, &nanoseconds);
+        float milliseconds = (float) ((double) nanoseconds * 1e-6);
+        history[timing.pass][slot] += milliseconds;
+        if (csv)
+            fmt::format_to(std::ostreambuf_iterator<char>(*csv), "{},{},{:.4f}\n", frame.number, names[timing.pass], milliseconds);
+    }
+    samples++;
+    frame.pending = false;
+    return true;
+}
+
+float GpuProfiler::average(unsigned int pass) const {
+    unsigned int count = samples < window ? samples : window;
+    if (count == 0)
+        return 0.0f;
+    float sum = 0.0f;
+    for (unsigned int i = 0; i < count; i++)
+        sum += history[pass][i];
+    return sum / (float) count;
+}
+
+float GpuProfiler::total_average() const {
+    float total = 0.0f;
+    for (unsigned int pass = 0; pass < passes(); pass++)
+        total += average(pass);
+    return total;
+}
+
+char *GpuProfiler::summary(char *out, char *end) const {
+    out = fmt::format_to_n(out, end - out, "{:.2f} ms GPU (", total_average()).out;
+    for (unsigned int pass = 0; pass < passes(); pass++)
+        out = fmt::format_to_n(out, end - out, "{}{} {:.2f}", pass ? ", " : "", names[pass], average(pass)).out;
+    return fmt::format_to_n(out, end - out, ")").out;
+}
+
+void GpuProfiler::write_statistics(std::ostream &out, double pixels) const {
+    // the geometry shader amplification is emitted over submitted primitives,
+    // e.g. 6 for a cube map rendered in one pass
+    out << fmt::format("{:<20}", "pass");
+    for (int i = 0; i < PIPELINE_STATISTIC_COUNT; i++)
+        out << fmt::format(" {:>14}", pipeline_statistic_name((PipelineStatistic) i));
+    out << fmt::format(" {:>14} {:>14}\n", "gs amplif.", "fs per pixel");
+    for (unsigned int pass = 0; pass < passes(); pass++) {
+        const PipelineCounts &passCounts = counts[pass];
+        out << fmt::format("{:<20}", names[pass]);
+        for (GLuint64 count : passCounts)
+            out << fmt::format(" {:>14}", count);
+        GLuint64 primitives = passCounts[PIPELINE_STATISTIC_PRIMITIVES];
+        double amplification = primitives ? (double) passCounts[PIPELINE_STATISTIC_GEOMETRY_PRIMITIVES] / (double) primitives : 0.0;
+        out << fmt::format(" {:>14.2f} {:>14.2f}\n", amplification,
+                           pixels > 0.0 ? (double) passCounts[PIPELINE_STATISTIC_FRAGMENT_SHADER] / pixels : 0.0);
+    }
+}
+
+void GpuProfiler::write_csv(std::ostream *_csv) {
+    csv = _csv;
+    if (csv)
+        *csv << "frame,pass,milliseconds\n";
+}
+
+#endif //PROJECT_BASE_GPU_QUERIES_HPP
@@ -7,7 +7,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <learnopengl/shader.h>
+#include <render_stats.hpp>
 
+#include <cmath>
 #include <string>
 #include <vector>
 using namespace std;
@@ -42,6 +44,13 @@ public:
 
     unsigned int VAO;
     std::string glslIdentifierPrefix;
+    // sampler uniform of every texture, e.g. texture_diffuse1, named on the first draw
+    vector<string> samplerNames;
+    // model space bounds for culling: box, and a sphere around the box center
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    glm::vec3 boundsCenter;
+    float boundsRadius;
     // constructor
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
     {
@@ -51,36 +60,24 @@ public:
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
+        computeBounds();
     }
 
     // render the mesh
     void Draw(Shader &shader)
     {
         // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
+        if (samplerNames.size() != textures.size())
+            nameSamplers();
         for(unsigned int i = 0; i < textures.size(); i++)
         {
             glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
-            else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to stream
-
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
+            glUniform1i(glGetUniformLocation(shader.ID, samplerNames[i].c_str()), i);
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
+        render_stats().textureBinds += textures.size();
 
 
 
@@ -88,6 +85,8 @@ public:
         glBindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
+        render_stats().drawCalls++;
+        render_stats().vertexArrayBinds++;
 
         // always good practice to set everything back to defaults once configured.
         glActiveTexture(GL_TEXTURE0);
@@ -97,6 +96,47 @@ private:
     // render data
     unsigned int VBO, EBO;
 
+    // names the samplers once, instead of building the strings on every draw
+    void nameSamplers()
+    {
+        unsigned int diffuseNr  = 1;
+        unsigned int specularNr = 1;
+        unsigned int normalNr   = 1;
+        unsigned int heightNr   = 1;
+        samplerNames.clear();
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            // retrieve texture number (the N in diffuse_textureN)
+            string number;
+            string name = textures[i].type;
+            if(name == "texture_diffuse")
+                number = std::to_string(diffuseNr++);
+            else if(name == "texture_specular")
+                number = std::to_string(specularNr++); // transfer unsigned int to stream
+            else if(name == "texture_normal")
+                number = std::to_string(normalNr++); // transfer unsigned int to stream
+            else if(name == "texture_height")
+                number = std::to_string(heightNr++); // transfer unsigned int to stream
+            samplerNames.push_back(glslIdentifierPrefix + name + number);
+        }
+    }
+
+    void computeBounds()
+    {
+        boundsMin = glm::vec3(INFINITY);
+        boundsMax = glm::vec3(-INFINITY);
+        for (const Vertex &vertex : vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
+        }
+        // tighter than the half diagonal of the box for round pieces
+        boundsCenter = 0.5f * (boundsMin + boundsMax);
+        boundsRadius = 0.0f;
+        for (const Vertex &vertex : vertices)
+            boundsRadius = glm::max(boundsRadius, glm::length(vertex.Position - boundsCenter));
+    }
+
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
@@ -12,6 +12,7 @@
 
 #include <learnopengl/mesh.h>
 #include <learnopengl/shader.h>
+#include <shadow_proxy.hpp>
 
 #include <string>
 #include <fstream>
@@ -33,11 +34,17 @@ public:
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    // optional low-poly, position-only mesh for the depth passes
+    ShadowProxy shadowProxy;
+    // model space bounding box of all meshes
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
 
     // constructor, expects a filepath to a 3D model.
     Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
     {
         loadModel(path);
+        computeBounds();
     }
 
     // draws the model, and thus all its meshes
@@ -47,12 +54,39 @@ public:
             meshes[i].Draw(shader);
     }
 
+    // draws the shadow proxy if the model has one, the full meshes otherwise
+    void DrawShadow(Shader &shader)
+    {
+        if (shadowProxy.empty())
+            Draw(shader);
+        else
+            shadowProxy.draw();
+    }
+
+    // builds the shadow proxy, maxError is a fraction of the bounding box diagonal
+    void GenerateShadowProxy(float maxError)
+    {
+        shadowProxy = build_shadow_proxy(meshes, maxError);
+    }
+
     void SetShaderTextureNamePrefix(std::string prefix) {
         for (Mesh& mesh: meshes) {
             mesh.glslIdentifierPrefix = prefix;
+            mesh.samplerNames.clear();
         }
     }
 private:
+    void computeBounds()
+    {
+        boundsMin = glm::vec3(INFINITY);
+        boundsMax = glm::vec3(-INFINITY);
+        for (const Mesh &mesh : meshes)
+        {
+            boundsMin = glm::min(boundsMin, mesh.boundsMin);
+            boundsMax = glm::max(boundsMax, mesh.boundsMax);
+        }
+    }
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
     {
@@ -4,6 +4,8 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <render_stats.hpp>
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -12,9 +14,10 @@ class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly, defines are inserted
+    // right after the #version line of every stage
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string &defines = "")
     {
         std::string vertexPathString(vertexPath);
         std::string fragmentPathString(fragmentPath);
@@ -45,8 +48,8 @@ public:
             vShaderFile.close();
             fShaderFile.close();
             // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
+            vertexCode = injectDefines(resolveIncludes(vShaderStream.str(), vertexPathString), defines);
+            fragmentCode = injectDefines(resolveIncludes(fShaderStream.str(), fragmentPathString), defines);
             // if geometry shader path is present, also load a geometry shader
             if(geometryPath != nullptr)
             {
@@ -56,7 +59,7 @@ public:
                 std::stringstream gShaderStream;
                 gShaderStream << gShaderFile.rdbuf();
                 gShaderFile.close();
-                geometryCode = gShaderStream.str();
+                geometryCode = injectDefines(resolveIncludes(gShaderStream.str(), geometryPathString), defines);
             }
         }
         catch (std::ifstream::failure& e)
@@ -107,67 +110,139 @@ public:
     void use() const
     { 
         glUseProgram(ID); 
+        render_stats().programBinds++;
     }
-    // utility uniform functions
+    // utility uniform functions, names are C strings so that literals don't
+    // build a std::string on every call
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(const char *name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(glGetUniformLocation(ID, name), (int)value); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(const char *name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(glGetUniformLocation(ID, name), value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(const char *name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(glGetUniformLocation(ID, name), value); 
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(const char *name, const glm::vec2 &value) const
+    { 
+        glUniform2fv(glGetUniformLocation(ID, name), 1, &value[0]); 
+    }
+    void setVec2(const char *name, float x, float y) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2f(glGetUniformLocation(ID, name), x, y); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setIVec2(const char *name, const glm::ivec2 &value) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2iv(glGetUniformLocation(ID, name), 1, &value[0]); 
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(const char *name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(glGetUniformLocation(ID, name), 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(const char *name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(glGetUniformLocation(ID, name), x, y, z); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(const char *name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(glGetUniformLocation(ID, name), 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    void setVec4(const char *name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(glGetUniformLocation(ID, name), x, y, z, w); 
+    }
+    // ------------------------------------------------------------------------
+    void setMat2(const char *name, const glm::mat2 &mat) const
+    {
+        glUniformMatrix2fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat3(const char *name, const glm::mat3 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat4(const char *name, const glm::mat4 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
     }
+    // location of a uniform set on every draw, looked up once and kept; keyed
+    // by the name's address, so it has to be a literal
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    int cachedLocation(const char *name) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        for (int i = 0; i < cachedCount; i++)
+        {
+            if (cachedNames[i] == name)
+                return cachedLocations[i];
+        }
+        int location = glGetUniformLocation(ID, name);
+        if (cachedCount < MAX_CACHED_LOCATIONS)
+        {
+            cachedNames[cachedCount] = name;
+            cachedLocations[cachedCount++] = location;
+        }
+        return location;
     }
 
 private:
+    static const int MAX_CACHED_LOCATIONS = 4;
+    mutable const char *cachedNames[MAX_CACHED_LOCATIONS];
+    mutable int cachedLocations[MAX_CACHED_LOCATIONS];
+    mutable int cachedCount = 0;
+
+    // replaces every #include "file" line with the contents of that file, looked up
+    // next to the including file, so shaders can share code
+    // ------------------------------------------------------------------------
+    static std::string resolveIncludes(const std::string &source, const std::string &path)
+    {
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        std::stringstream input(source);
+        std::stringstream output;
+        std::string line;
+        while (std::getline(input, line))
+        {
+            size_t start = line.find("#include \"");
+            if (start == std::string::npos)
+            {
+                output << line << '\n';
+                continue;
+            }
+            start += 10;
+            std::string includePath = directory + line.substr(start, line.find('"', start) - start);
+            std::ifstream includeFile(includePath);
+            if (!includeFile)
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND " << includePath << std::endl;
+                continue;
+            }
+            std::stringstream includeStream;
+            includeStream << includeFile.rdbuf();
+            output << resolveIncludes(includeStream.str(), includePath);
+        }
+        return output.str();
+    }
+    // inserts the defines after the #version line, which has to stay first
+    // ------------------------------------------------------------------------
+    static std::string injectDefines(const std::string &source, const std::string &defines)
+    {
+        if (defines.empty())
+            return source;
+        size_t version = source.find("#version");
+        size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return defines + "\n" + source;
+        return source.substr(0, lineEnd + 1) + defines + "\n" + source.substr(lineEnd + 1);
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     static void checkCompileErrors(GLuint shader, const std::string& type)
@@ -0,0 +1,96 @@
+#ifndef PROJECT_BASE_LIGHT_CULLING_HPP
+#define PROJECT_BASE_LIGHT_CULLING_HPP
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include <lights.hpp>
+#include <scene.hpp>
+
+// Bounding volume of one shadowed light: its attenuation range sphere, and for
+// spotlights also the cone. A spotlight's ambient term is only attenuated, not
+// limited by the cone, so it reaches the whole range sphere too.
+struct LightVolume {
+    glm::vec3 position;
+    float range;
+    bool spot;
+    glm::vec3 direction;
+    float cosOuter;
+    glm::vec3 sphereCenter; // bounding sphere of the lit volume
+    float sphereRadius;
+};
+
+// Per instance light lists for the forward pass, built once a frame: every
+// light asks the scene's BVH for the instances within its range. The lights are
+// indexed by their slot in the shader arrays: enabled point lights first, then
+// enabled spots, the same order setLightUniforms uploads them in. A spotlight
+// whose range reaches the instance but whose cone doesn't is listed as
+// -1 - slot, the shader then adds only its ambient term, so culling never
+// changes the image.
+class LightCuller {
+public:
+    static const int MAX_LIGHTS = 16;
+
+    // light-instance pairs of this frame, all of them and the lit ones
+    unsigned int pairsTested;
+    unsigned int pairsKept;
+
+    LightCuller() : pairsTested(0), pairsKept(0) {};
+    void begin_frame(const std::vector<PointLight> &pointLights, const std::vector<SpotLight> &spotLights, const Scene &scene);
+    // the slots of the lights reaching a scene instance, valid until the next begin_frame
+    int count(unsigned int instance) const { return counts[instance]; }
+    const int *slots(unsigned int instance) const { return &lists[instance * MAX_LIGHTS]; }
+
+private:
+    std::vector<LightVolume> volumes;
+    std::vector<int> counts;
+    std::vector<int> lists; // MAX_LIGHTS per instance
+    std::vector<unsigned int> reached; // instances the BVH returned for a light
+};
+
+void LightCuller::begin_frame(const std::vector<PointLight> &pointLights, const std::vector<SpotLight> &spotLights, const Scene &scene) {
+    volumes.clear();
+    for (const PointLight &light : pointLights) {
+        if (!light.enabled)
+            continue;
+        float range = light.range();
+        volumes.push_back({light.position, range, false, glm::vec3(0.0f), -1.0f, light.position, range});
+    }
+    for (const SpotLight &light : spotLights) {
+        if (!light.enabled)
+            continue;
+        float range = light.range();
+        volumes.push_back({light.position, range, true, light.direction, light.outerCutOff, light.position, range});
+    }
+
+    unsigned int instances = (unsigned int) scene.instances.size();
+    pairsTested = (unsigned int) volumes.size() * instances;
+    pairsKept = 0;
+    counts.assign(instances, 0);
+    lists.resize(instances * MAX_LIGHTS);
+    // lights in slot order, so every list is sorted
+    for (unsigned int i = 0; i < volumes.size(); i++) {
+        const LightVolume &volume = volumes[i];
+        reached.clear();
+        scene.query_sphere(volume.sphereCenter, volume.sphereRadius, reached);
+        for (unsigned int instance : reached) {
+            if (counts[instance] == MAX_LIGHTS)
+                continue;
+            const SceneInstance &lit = scene.instances[instance];
+            int *slots = &lists[instance * MAX_LIGHTS];
+            if (volume.spot) {
+                glm::vec3 boxCenter = (lit.boundsMin + lit.boundsMax) * 0.5f;
+                float boxRadius = glm::length(lit.boundsMax - boxCenter);
+                if (!sphere_intersects_cone(volume.position, volume.direction, volume.range, volume.cosOuter, boxCenter, boxRadius)) {
+                    slots[counts[instance]++] = -1 - (int) i; // ambient only
+                    continue;
+                }
+            }
+            slots[counts[instance]++] = (int) i;
+            pairsKept++;
+        }
+    }
+}
+
+#endif //PROJECT_BASE_LIGHT_CULLING_HPP
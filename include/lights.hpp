@@ -3,6 +3,47 @@
 
 #include <glm/glm.hpp>
 
+#include <cmath>
+
+// Distance at which attenuation brings the brightest channel of a light below
+// 5/256, past that its contribution is no longer visible.
+inline float attenuation_range(float constant, float linear, float quadratic, glm::vec3 color) {
+    float peak = glm::max(glm::max(color.x, color.y), color.z);
+    float limit = peak * 256.0f / 5.0f;
+    if (limit <= constant)
+        return 0.0f;
+    if (quadratic <= 0.0f)
+        return linear > 0.0f ? (limit - constant) / linear : INFINITY;
+    return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * (constant - limit))) / (2.0f * quadratic);
+}
+
+// Bounding sphere of a spotlight's lit volume, the cone's spherical sector:
+// for narrow cones the sphere through the apex and the cap rim, for wide ones
+// the sphere around the cap rim.
+inline void spot_bounding_sphere(glm::vec3 position, glm::vec3 direction, float range, float cosOuter,
+                                 glm::vec3 &center, float &radius) {
+    if (cosOuter >= 0.70710678f) {
+        radius = range / (2.0f * cosOuter);
+        center = position + direction * radius;
+    } else {
+        float sinOuter = std::sqrt(glm::max(0.0f, 1.0f - cosOuter * cosOuter));
+        center = position + direction * (range * cosOuter);
+        radius = range * sinOuter;
+    }
+}
+
+// Conservative sphere against cone test, the cone given by its apex, unit axis,
+// length and the cosine of its half angle.
+inline bool sphere_intersects_cone(glm::vec3 apex, glm::vec3 axis, float range, float cosOuter,
+                                   glm::vec3 center, float radius) {
+    float sinOuter = std::sqrt(glm::max(0.0f, 1.0f - cosOuter * cosOuter));
+    glm::vec3 v = center - apex;
+    float vLengthSq = glm::dot(v, v);
+    float v1Length = glm::dot(v, axis);
+    float distanceClosest = cosOuter * std::sqrt(glm::max(0.0f, vLengthSq - v1Length * v1Length)) - v1Length * sinOuter;
+    return !(distanceClosest > radius || v1Length > radius + range || v1Length < -radius);
+}
+
 struct PointLight {
     glm::vec3 position;
 
@@ -15,6 +56,7 @@ struct PointLight {
     float quadratic;
 
     bool enabled;
+    bool castShadows;
 
     PointLight() :
         position(glm::vec3(0.0, 0.0, 4.0)),
@@ -24,13 +66,18 @@ struct PointLight {
         constant(1.0f),
         linear(0.09f),
         quadratic(0.032f),
-        enabled(false) {};
+        enabled(false),
+        castShadows(true) {};
 
     void set_light(glm::vec3 _diffuse) {
         diffuse = _diffuse;
         specular = _diffuse;
         ambient = glm::normalize(_diffuse);
     }
+
+    float range() const {
+        return attenuation_range(constant, linear, quadratic, glm::max(diffuse, specular));
+    }
 };
 
 struct SpotLight {
@@ -48,6 +95,7 @@ struct SpotLight {
     glm::vec3 specular;
 
     bool enabled;
+    bool castShadows;
 
     SpotLight() :
         position(glm::vec3(0.0, 0.0, 4.0)),
@@ -60,13 +108,18 @@ struct SpotLight {
         ambient(glm::vec3(0.0f)),
         diffuse(glm::vec3(3.0f)),
         specular(glm::vec3(3.0f)),
-        enabled(false) {};
+        enabled(false),
+        castShadows(true) {};
 
     void set_light(glm::vec3 _diffuse) {
         diffuse = _diffuse;
         specular = _diffuse;
         ambient = glm::normalize(_diffuse);
     }
+
+    float range() const {
+        return attenuation_range(constant, linear, quadratic, glm::max(diffuse, specular));
+    }
 };
 
 #endif //PROJECT_BASE_LIGHTS_HPP
@@ -0,0 +1,295 @@
+#ifndef PROJECT_BASE_OCCLUSION_CULLING_HPP
+#define PROJECT_BASE_OCCLUSION_CULLING_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <learnopengl/shader.h>
+#include <frustum_culling.hpp>
+#include <scene.hpp>
+
+// Hierarchical Z occlusion culling of the forward lighting pass. The depth
+// prepass of the same frame is copied and reduced into a max-depth pyramid
+// (hiz_reduce.frag), so the test is exact for the current camera and nothing
+// pops in when it moves. Every instance then draws one point through
+// hiz_test.vert, which lands on screen only if the instance's box reaches in
+// front of the pyramid, counted by an any-samples-passed query. The lit draws
+// are rendered conditionally on those queries, on the GPU, without readbacks.
+class OcclusionCuller {
+public:
+    // instances tested and found occluded, from the latest frame with results
+    unsigned int tested;
+    unsigned int occluded;
+
+    OcclusionCuller(int _width, int _height);
+    // reallocates the pyramid if the size changed
+    void resize(int _width, int _height);
+    // copies the depth of the default framebuffer and reduces it into the pyramid
+    void build(Shader &reduceShader, unsigned int emptyVAO);
+    // issues the occlusion query of every instance that survived frustum culling
+    void test(const std::vector<SceneInstance> &instances, const FrustumCuller &culler, const glm::mat4 &viewProjection,
+              Shader &testShader, unsigned int emptyVAO);
+    // draws between these are skipped on the GPU if the instance was occluded
+    void begin_draw(unsigned int instance) const;
+    void end_draw(unsigned int instance) const;
+    // waits for the instance's query of this frame, false if it was found occluded
+    bool passed(unsigned int instance) const;
+    bool tested_this_frame(unsigned int instance) const { return instance < issued.size() && issued[instance]; }
+    size_t bytes() const;
+
+private:
+    unsigned int depthFBO;
+    unsigned int depth;
+    unsigned int pyramidFBO;
+    unsigned int pyramid;
+    int width;
+    int height;
+    int levels;
+    std::vector<unsigned int> queries;
+    std::vector<uint8_t> issued;
+
+    void allocate();
+    void collect_results();
+};
+
+OcclusionCuller::OcclusionCuller(int _width, int _height) :
+    tested(0),
+    occluded(0),
+    width(_width),
+    height(_height),
+    levels(1) {
+
+    glGenFramebuffers(1, &depthFBO);
+    glGenFramebuffers(1, &pyramidFBO);
+    glGenTextures(1, &depth);
+    glGenTextures(1, &pyramid);
+    for (unsigned int texture : {depth, pyramid}) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    allocate();
+}
+
+void OcclusionCuller::allocate() {
+    // depth blits need matching formats, this is GLFW's default depth and stencil
+    glBindTexture(GL_TEXTURE_2D, depth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr);
+    glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    // level 0 is half the screen, each texel the farthest depth of the pixels it covers
+    glBindTexture(GL_TEXTURE_2D, pyramid);
+    int levelWidth = glm::max(width / 2, 1), levelHeight = glm::max(height / 2, 1);
+    levels = 0;
+    while (true) {
+        glTexImage2D(GL_TEXTURE_2D, levels, GL_R32F, levelWidth, levelHeight, 0, GL_RED, GL_FLOAT, nullptr);
+        levels++;
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        levelWidth = glm::max(levelWidth / 2, 1);
+        levelHeight = glm::max(levelHeight / 2, 1);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void OcclusionCuller::resize(int _width, int _height) {
+    if (_width == width && _height == height)
+        return;
+    width = _width;
+    height = _height;
+    allocate();
+}
+
+void OcclusionCuller::build(Shader &reduceShader, unsigned int emptyVAO) {
+    // resolves the multisampled depth, the half resolution level 0 absorbs
+    // most of the difference between the samples
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFBO);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, pyramidFBO);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindVertexArray(emptyVAO);
+    reduceShader.use();
+    reduceShader.setInt("source", 0);
+    glActiveTexture(GL_TEXTURE0);
+    int sourceWidth = width, sourceHeight = height;
+    for (int level = 0; level < levels; level++) {
+        int levelWidth = glm::max(sourceWidth / 2, 1), levelHeight = glm::max(sourceHeight / 2, 1);
+        // reads only the previous level, so it is never also the render target;
+        // texelFetch counts from the base level, so that level is lod 0
+        if (level == 0) {
+            glBindTexture(GL_TEXTURE_2D, depth);
+        } else {
+            glBindTexture(GL_TEXTURE_2D, pyramid);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        }
+        reduceShader.setIVec2("sourceSize", glm::ivec2(sourceWidth, sourceHeight));
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, level);
+        glViewport(0, 0, levelWidth, levelHeight);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        sourceWidth = levelWidth;
+        sourceHeight = levelHeight;
+    }
+    glBindTexture(GL_TEXTURE_2D, pyramid);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    glEnable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void OcclusionCuller::collect_results() {
+    // the conditional draws already waited for them, so last frame's are in
+    unsigned int frameTested = 0, frameOccluded = 0;
+    for (unsigned int i = 0; i < issued.size(); i++) {
+        if (!issued[i])
+            continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint anySamples = 0;
+        glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT, &anySamples);
+        frameTested++;
+        frameOccluded += anySamples ? 0 : 1;
+    }
+    tested = frameTested;
+    occluded = frameOccluded;
+}
+
+void OcclusionCuller::test(const std::vector<SceneInstance> &instances, const FrustumCuller &culler,
+                           const glm::mat4 &viewProjection, Shader &testShader, unsigned int emptyVAO) {
+    collect_results();
+    while (queries.size() < instances.size()) {
+        unsigned int query;
+        glGenQueries(1, &query);
+        queries.push_back(query);
+    }
+    issued.assign(instances.size(), 0);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(emptyVAO);
+    testShader.use();
+    testShader.setMat4("viewProjection", viewProjection);
+    testShader.setIVec2("hiZSize", glm::ivec2(glm::max(width / 2, 1), glm::max(height / 2, 1)));
+    testShader.setInt("hiZLevels", levels);
+    testShader.setInt("hiZ", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, pyramid);
+    for (unsigned int i = 0; i < instances.size(); i++) {
+        if (!culler.instance_visible(i))
+            continue;
+        testShader.setVec3("boundsMin", instances[i].boundsMin);
+        testShader.setVec3("boundsMax", instances[i].boundsMax);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[i]);
+        glDrawArrays(GL_POINTS, 0, 1);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        issued[i] = 1;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void OcclusionCuller::begin_draw(unsigned int instance) const {
+    if (instance < issued.size() && issued[instance])
+        glBeginConditionalRender(queries[instance], GL_QUERY_WAIT);
+}
+
+void OcclusionCuller::end_draw(unsigned int instance) const {
+    if (instance < issued.size() && issued[instance])
+        glEndConditionalRender();
+}
+
+bool OcclusionCuller::passed(unsigned int instance) const {
+    GLuint anySamples = 1;
+    if (tested_this_frame(instance))
+        glGetQueryObjectuiv(queries[instance], GL_QUERY_RESULT, &anySamples);
+    return anySamples != 0;
+}
+
+size_t OcclusionCuller::bytes() const {
+    // depth copy, and the pyramid, a third more than its half resolution level 0
+    return (size_t) width * height * 4 + (size_t) (width / 2) * (height / 2) * 4 * 4 / 3;
+}
+
+// Checks the culler against the ground truth: right after its test, every
+// instance it tested is drawn again against the prepass depth, with depth
+// writes off, counting the samples that reach the depth the prepass left. An
+// instance with any is visible without occlusion culling, so the culler must
+// have passed it too; one it didn't is wrongly occluded. Waits for the GPU,
+// for --occlusion-check only.
+class OcclusionCheck {
+public:
+    unsigned int frames;
+    unsigned long long visibleWithout; // instances, summed over the frames
+    unsigned long long visibleWith;
+    unsigned long long wronglyOccluded;
+
+    OcclusionCheck() : frames(0), visibleWithout(0), visibleWith(0), wronglyOccluded(0) {};
+    // draw(i) draws instance i's opaque fragments with a depth-only shader
+    template<typename Draw>
+    void run(const std::vector<SceneInstance> &instances, const OcclusionCuller &culler, Draw draw);
+
+private:
+    std::vector<unsigned int> queries;
+};
+
+template<typename Draw>
+void OcclusionCheck::run(const std::vector<SceneInstance> &instances, const OcclusionCuller &culler, Draw draw) {
+    while (queries.size() < instances.size()) {
+        unsigned int query;
+        glGenQueries(1, &query);
+        queries.push_back(query);
+    }
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
+    for (unsigned int i = 0; i < instances.size(); i++) {
+        if (!culler.tested_this_frame(i))
+            continue;
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[i]);
+        draw(i);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+    }
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    for (unsigned int i = 0; i < instances.size(); i++) {
+        if (!culler.tested_this_frame(i))
+            continue;
+        GLuint anySamples = 0;
+        glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT, &anySamples);
+        bool passed = culler.passed(i);
+        visibleWithout += anySamples ? 1 : 0;
+        visibleWith += passed ? 1 : 0;
+        wronglyOccluded += anySamples && !passed ? 1 : 0;
+    }
+    frames++;
+}
+
+#endif //PROJECT_BASE_OCCLUSION_CULLING_HPP
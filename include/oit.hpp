@@ -0,0 +1,112 @@
+#ifndef PROJECT_BASE_OIT_HPP
+#define PROJECT_BASE_OIT_HPP
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+#include <learnopengl/shader.h>
+
+// Targets of weighted blended order-independent transparency, 14 bytes per pixel:
+//   RGBA16F  weighted premultiplied color in rgb, revealage in alpha
+//   R16F     sum of the weighted alphas
+//   DEPTH24_STENCIL8  copy of the opaque depth, tested but not written
+// GL 3.3 has a single blend state for all draw buffers, so instead of the usual
+// separate revealage target the revealage rides in the alpha of the color
+// target: glBlendFuncSeparate(ONE, ONE, ZERO, ONE_MINUS_SRC_ALPHA) adds the
+// colors and multiplies in (1 - alpha). The weight sum goes to the red
+// channel of the second target, also added. oit_composite.frag resolves them.
+class OITBuffer {
+public:
+    unsigned int FBO;
+    unsigned int accum;
+    unsigned int weight;
+    unsigned int depth;
+    int width;
+    int height;
+
+    OITBuffer(int _width, int _height);
+    // reallocates the attachments if the size changed
+    void resize(int _width, int _height);
+    // copies the depth of the default framebuffer, binds the targets and clears them
+    void begin();
+    // binds the color targets to units firstUnit and firstUnit+1 and sets the samplers
+    void bind_textures(Shader &shader, int firstUnit) const;
+    size_t bytes() const { return (size_t) width * height * 14; }
+
+private:
+    void allocate();
+};
+
+OITBuffer::OITBuffer(int _width, int _height) :
+    width(_width),
+    height(_height) {
+
+    glGenFramebuffers(1, &FBO);
+    unsigned int textures[2];
+    glGenTextures(2, textures);
+    accum = textures[0];
+    weight = textures[1];
+    for (unsigned int texture : textures) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    // depth blits need matching formats, this is GLFW's default depth and stencil
+    glGenRenderbuffers(1, &depth);
+    allocate();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accum, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weight, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+    const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void OITBuffer::allocate() {
+    glBindTexture(GL_TEXTURE_2D, accum);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, weight);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED, GL_HALF_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+void OITBuffer::resize(int _width, int _height) {
+    if (_width == width && _height == height)
+        return;
+    width = _width;
+    height = _height;
+    allocate();
+}
+
+void OITBuffer::begin() {
+    // resolves the multisampled depth, one sample per pixel is enough to occlude
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    const float clearAccum[] = {0.0f, 0.0f, 0.0f, 1.0f};
+    const float clearWeight[] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 0, clearAccum);
+    glClearBufferfv(GL_COLOR, 1, clearWeight);
+}
+
+void OITBuffer::bind_textures(Shader &shader, int firstUnit) const {
+    const unsigned int textures[2] = {accum, weight};
+    const char *names[2] = {"oitAccum", "oitWeight"};
+    for (int i = 0; i < 2; i++) {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        shader.setInt(names[i], firstUnit + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+#endif //PROJECT_BASE_OIT_HPP
@@ -0,0 +1,88 @@
+#ifndef PROJECT_BASE_OVERDRAW_HPP
+#define PROJECT_BASE_OVERDRAW_HPP
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+#include <learnopengl/shader.h>
+
+// Counter target of the overdraw view, 6 bytes per pixel:
+//   R16F     fragments shaded at the pixel, every one adds 1 with
+//            glBlendFunc(ONE, ONE); half floats count exactly up to 2048
+//   DEPTH24_STENCIL8  depth tested and written like the opaque pass, so the
+//            count depends on the draw order
+// overdraw_heatmap.frag turns the counts into colors.
+class OverdrawBuffer {
+public:
+    unsigned int FBO;
+    unsigned int counts;
+    unsigned int depth;
+    int width;
+    int height;
+
+    OverdrawBuffer(int _width, int _height);
+    // reallocates the attachments if the size changed
+    void resize(int _width, int _height);
+    // binds the target and clears the counts and the depth
+    void begin();
+    // binds the counts to the unit and sets the sampler
+    void bind_texture(Shader &shader, int unit) const;
+    size_t bytes() const { return (size_t) width * height * 6; }
+
+private:
+    void allocate();
+};
+
+OverdrawBuffer::OverdrawBuffer(int _width, int _height) :
+    width(_width),
+    height(_height) {
+
+    glGenFramebuffers(1, &FBO);
+    glGenTextures(1, &counts);
+    glBindTexture(GL_TEXTURE_2D, counts);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenRenderbuffers(1, &depth);
+    allocate();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, counts, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void OverdrawBuffer::allocate() {
+    glBindTexture(GL_TEXTURE_2D, counts);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED, GL_HALF_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+void OverdrawBuffer::resize(int _width, int _height) {
+    if (_width == width && _height == height)
+        return;
+    width = _width;
+    height = _height;
+    allocate();
+}
+
+void OverdrawBuffer::begin() {
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    const float clearCounts[] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 0, clearCounts);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void OverdrawBuffer::bind_texture(Shader &shader, int unit) const {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, counts);
+    shader.setInt("overdrawCounts", unit);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+#endif //PROJECT_BASE_OVERDRAW_HPP
@@ -0,0 +1,138 @@
+#ifndef PROJECT_BASE_PICKING_HPP
+#define PROJECT_BASE_PICKING_HPP
+
+#include <glm/glm.hpp>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <learnopengl/model.h>
+#include <bvh.hpp>
+#include <scene.hpp>
+
+// Moller-Trumbore, distance along the ray to the hit in distance
+inline bool ray_hits_triangle(glm::vec3 origin, glm::vec3 direction, glm::vec3 a, glm::vec3 b, glm::vec3 c, float &distance) {
+    glm::vec3 edge1 = b - a, edge2 = c - a;
+    glm::vec3 p = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, p);
+    // both sides count, the models are not all wound the same way
+    if (glm::abs(determinant) < 1e-12f)
+        return false;
+    float inverseDeterminant = 1.0f / determinant;
+    glm::vec3 s = origin - a;
+    float u = glm::dot(s, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+    distance = glm::dot(edge2, q) * inverseDeterminant;
+    return distance >= 0.0f;
+}
+
+// Model space triangles of one model under a BVH of their boxes, kept on the
+// CPU so rays can be cast against the exact surface without reading anything
+// back from the GPU.
+class PickMesh {
+public:
+    explicit PickMesh(const Model &model);
+    // nearest hit closer than distance, which it then holds
+    bool raycast(glm::vec3 origin, glm::vec3 direction, float &distance) const;
+    unsigned int triangles() const { return (unsigned int) corners.size() / 3; }
+
+private:
+    std::vector<glm::vec3> corners; // three per triangle
+    DynamicBVH tree;
+};
+
+PickMesh::PickMesh(const Model &model) {
+    for (const Mesh &mesh : model.meshes) {
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            for (int k = 0; k < 3; k++)
+                corners.push_back(mesh.vertices[mesh.indices[i + k]].Position);
+        }
+    }
+    for (unsigned int triangle = 0; triangle < triangles(); triangle++) {
+        const glm::vec3 *t = &corners[triangle * 3];
+        tree.insert(triangle, glm::min(t[0], glm::min(t[1], t[2])), glm::max(t[0], glm::max(t[1], t[2])));
+    }
+}
+
+bool PickMesh::raycast(glm::vec3 origin, glm::vec3 direction, float &distance) const {
+    glm::vec3 inverseDirection = 1.0f / direction;
+    bool hit = false;
+    float entry;
+    // the closest hit so far shortens the ray, pruning the rest of the tree
+    tree.query([&](glm::vec3 boundsMin, glm::vec3 boundsMax) {
+                   return ray_hits_box(origin, inverseDirection, distance, boundsMin, boundsMax, entry);
+               },
+               [&](unsigned int triangle) {
+                   float t;
+                   const glm::vec3 *c = &corners[triangle * 3];
+                   if (ray_hits_triangle(origin, direction, c[0], c[1], c[2], t) && t < distance) {
+                       distance = t;
+                       hit = true;
+                   }
+               });
+    return hit;
+}
+
+struct PickHit {
+    unsigned int instance;
+    float distance;
+    glm::vec3 position;
+};
+
+// Casts rays against the scene: its BVH gives the instances whose bounds the
+// ray enters, nearest first, and only those are tested triangle by triangle,
+// in model space. Stops as soon as the next bounds start behind the best hit.
+class Picker {
+public:
+    // builds the triangle BVH of a model, once, before it is picked
+    void add(const Model *model);
+    bool raycast(const Scene &scene, glm::vec3 origin, glm::vec3 direction, float maxDistance, PickHit &hit) const;
+
+private:
+    std::map<const Model *, PickMesh> meshes;
+    mutable std::vector<std::pair<float, unsigned int>> candidates;
+};
+
+void Picker::add(const Model *model) {
+    if (meshes.find(model) == meshes.end())
+        meshes.emplace(model, PickMesh(*model));
+}
+
+bool Picker::raycast(const Scene &scene, glm::vec3 origin, glm::vec3 direction, float maxDistance, PickHit &hit) const {
+    direction = glm::normalize(direction);
+    // room for every instance, so picking doesn't allocate once it's warm
+    candidates.reserve(scene.instances.size());
+    candidates.clear();
+    scene.query_ray(origin, direction, maxDistance, candidates);
+    float best = maxDistance;
+    bool found = false;
+    for (const std::pair<float, unsigned int> &candidate : candidates) {
+        if (candidate.first > best)
+            break;
+        const SceneInstance &instance = scene.instances[candidate.second];
+        auto mesh = meshes.find(instance.model);
+        if (mesh == meshes.end())
+            continue;
+        // the direction stays unnormalized, so distances are still in world units
+        glm::mat4 inverse = glm::inverse(instance.transform);
+        glm::vec3 modelOrigin = glm::vec3(inverse * glm::vec4(origin, 1.0f));
+        glm::vec3 modelDirection = glm::vec3(inverse * glm::vec4(direction, 0.0f));
+        if (mesh->second.raycast(modelOrigin, modelDirection, best)) {
+            hit.instance = candidate.second;
+            found = true;
+        }
+    }
+    if (found) {
+        hit.distance = best;
+        hit.position = origin + direction * best;
+    }
+    return found;
+}
+
+#endif //PROJECT_BASE_PICKING_HPP
@@ -0,0 +1,22 @@
+#ifndef PROJECT_BASE_RENDER_STATS_HPP
+#define PROJECT_BASE_RENDER_STATS_HPP
+
+// Draw calls and state changes of the scene geometry, counted on the CPU where
+// Mesh, ShadowProxy and Shader issue them. Fullscreen passes are not counted.
+// Reset it before what should be measured, e.g. every frame.
+struct RenderStats {
+    unsigned long long drawCalls;
+    unsigned long long programBinds;
+    unsigned long long textureBinds;
+    unsigned long long vertexArrayBinds;
+
+    RenderStats() : drawCalls(0), programBinds(0), textureBinds(0), vertexArrayBinds(0) {};
+    unsigned long long state_changes() const { return programBinds + textureBinds + vertexArrayBinds; }
+};
+
+inline RenderStats &render_stats() {
+    static RenderStats stats;
+    return stats;
+}
+
+#endif //PROJECT_BASE_RENDER_STATS_HPP
@@ -0,0 +1,145 @@
+#ifndef PROJECT_BASE_SCENE_HPP
+#define PROJECT_BASE_SCENE_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <learnopengl/model.h>
+#include <bvh.hpp>
+
+// One drawn model: its transform, world space bounds and where it stands
+// relative to the camera this frame.
+struct SceneInstance {
+    Model *model;
+    glm::mat4 transform;
+    int tag; // caller-defined, e.g. the board square
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    float cameraDistance; // from the camera to the closest point of the bounds
+    bool translucent;     // reaches into the fade distance, so it may blend
+
+    SceneInstance(Model *_model, const glm::mat4 &_transform, int _tag = -1);
+    // meshVisible has a flag per mesh, see FrustumCuller; the shadow proxy stands for all of them
+    void draw(Shader &shader, bool shadowPass = false, const uint8_t *meshVisible = nullptr) const;
+};
+
+SceneInstance::SceneInstance(Model *_model, const glm::mat4 &_transform, int _tag) :
+    model(_model),
+    transform(_transform),
+    tag(_tag),
+    cameraDistance(0.0f),
+    translucent(false) {
+
+    // the transforms are translations and uniform scales, two corners suffice
+    glm::vec3 a = glm::vec3(transform * glm::vec4(model->boundsMin, 1.0f));
+    glm::vec3 b = glm::vec3(transform * glm::vec4(model->boundsMax, 1.0f));
+    boundsMin = glm::min(a, b);
+    boundsMax = glm::max(a, b);
+}
+
+void SceneInstance::draw(Shader &shader, bool shadowPass, const uint8_t *meshVisible) const {
+    glUniformMatrix4fv(shader.cachedLocation("model"), 1, GL_FALSE, &transform[0][0]);
+    if (shadowPass && !model->shadowProxy.empty()) {
+        model->DrawShadow(shader);
+        return;
+    }
+    for (unsigned int i = 0; i < model->meshes.size(); i++) {
+        if (!meshVisible || meshVisible[i])
+            model->meshes[i].Draw(shader);
+    }
+}
+
+// Classifies the instances against the camera. Translucent ones are blended
+// order independently, so nothing needs sorting.
+inline void classify_instances(std::vector<SceneInstance> &instances, glm::vec3 cameraPosition, float fadeDistance) {
+    for (SceneInstance &instance : instances) {
+        glm::vec3 closest = glm::clamp(cameraPosition, instance.boundsMin, instance.boundsMax);
+        instance.cameraDistance = glm::length(cameraPosition - closest);
+        instance.translucent = instance.cameraDistance < fadeDistance;
+    }
+}
+
+// Instances of the scene, kept together with a BVH over their bounds. Indices
+// into instances are what the queries return; removing an instance moves the
+// last one into its place, so they are only stable between removals.
+class Scene {
+public:
+    std::vector<SceneInstance> instances;
+
+    // returns the index of the new instance
+    unsigned int add(Model *model, const glm::mat4 &transform, int tag = -1);
+    // replaces an instance, a moved one only refits the BVH above it
+    void set(unsigned int index, Model *model, const glm::mat4 &transform);
+    void remove(unsigned int index);
+    void clear();
+
+    // instances whose bounds reach into the frustum planes, see Frustum
+    void query_frustum(const glm::vec4 planes[6], std::vector<unsigned int> &result) const;
+    // instances whose bounds overlap a sphere, e.g. the range of a light
+    void query_sphere(glm::vec3 center, float radius, std::vector<unsigned int> &result) const;
+    // instances whose bounds the ray enters within maxDistance, nearest entry first
+    void query_ray(glm::vec3 origin, glm::vec3 direction, float maxDistance,
+                   std::vector<std::pair<float, unsigned int>> &result) const;
+    const DynamicBVH &bvh() const { return tree; }
+
+private:
+    DynamicBVH tree;
+    std::vector<int> leaves; // BVH leaf of every instance
+};
+
+unsigned int Scene::add(Model *model, const glm::mat4 &transform, int tag) {
+    unsigned int index = (unsigned int) instances.size();
+    instances.emplace_back(model, transform, tag);
+    leaves.push_back(tree.insert(index, instances.back().boundsMin, instances.back().boundsMax));
+    return index;
+}
+
+void Scene::set(unsigned int index, Model *model, const glm::mat4 &transform) {
+    instances[index] = SceneInstance(model, transform, instances[index].tag);
+    tree.update(leaves[index], instances[index].boundsMin, instances[index].boundsMax);
+}
+
+void Scene::remove(unsigned int index) {
+    tree.remove(leaves[index]);
+    unsigned int last = (unsigned int) instances.size() - 1;
+    if (index != last) {
+        instances[index] = instances[last];
+        leaves[index] = leaves[last];
+        tree.set_item(leaves[index], index);
+    }
+    instances.pop_back();
+    leaves.pop_back();
+}
+
+void Scene::clear() {
+    while (!instances.empty())
+        remove((unsigned int) instances.size() - 1);
+}
+
+void Scene::query_frustum(const glm::vec4 planes[6], std::vector<unsigned int> &result) const {
+    tree.query([&](glm::vec3 boundsMin, glm::vec3 boundsMax) { return box_in_frustum(boundsMin, boundsMax, planes); },
+               [&](unsigned int index) { result.push_back(index); });
+}
+
+void Scene::query_sphere(glm::vec3 center, float radius, std::vector<unsigned int> &result) const {
+    tree.query([&](glm::vec3 boundsMin, glm::vec3 boundsMax) { return box_overlaps_sphere(boundsMin, boundsMax, center, radius); },
+               [&](unsigned int index) { result.push_back(index); });
+}
+
+void Scene::query_ray(glm::vec3 origin, glm::vec3 direction, float maxDistance,
+                      std::vector<std::pair<float, unsigned int>> &result) const {
+    glm::vec3 inverseDirection = 1.0f / direction;
+    size_t first = result.size();
+    float entry;
+    tree.query([&](glm::vec3 boundsMin, glm::vec3 boundsMax) {
+                   return ray_hits_box(origin, inverseDirection, maxDistance, boundsMin, boundsMax, entry);
+               },
+               [&](unsigned int index) { result.emplace_back(entry, index); });
+    std::sort(result.begin() + first, result.end());
+}
+
+#endif //PROJECT_BASE_SCENE_HPP
@@ -0,0 +1,131 @@
+#ifndef PROJECT_BASE_SHADER_VARIANTS_HPP
+#define PROJECT_BASE_SHADER_VARIANTS_HPP
+
+#include <fmt/core.h>
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <learnopengl/shader.h>
+#include <allocations.hpp>
+#include <shadows.hpp>
+
+// Optional fragment shader features, each maps to a #define of the same name
+// without the prefix. Disabled features are compiled out.
+enum ShaderFeature : uint32_t {
+    SHADER_FEATURE_FADE = 1u << 0,             // alpha fades out next to the camera
+    SHADER_FEATURE_FADED_ONLY = 1u << 1,       // only the faded fragments, for the translucent pass
+    SHADER_FEATURE_EVENT_LIGHTS = 1u << 2,     // there are event lights to loop over
+    SHADER_FEATURE_CLUSTERED_LIGHTS = 1u << 3, // only over those of the fragment's cluster
+    SHADER_FEATURE_LIGHT_LISTS = 1u << 4,      // shadowed lights from the draw's list, see LightCuller
+    SHADER_FEATURE_OIT = 1u << 5,              // weighted blended outputs, see OITBuffer
+    SHADER_FEATURE_UNFADED_ONLY = 1u << 6      // only the fragments that don't fade, for the opaque pass
+};
+
+// Variant cache key:
+//   bits  0..7   ShaderFeature flags
+//   bits  8..11  point light count
+//   bits 12..15  spotlight count
+//   bits 16..31  shadow mask, bit i set if light i casts shadows (points first)
+//   bits 32..33  shadow filter
+//   bit  34      shadow technique
+typedef uint64_t ShaderKey;
+
+const ShaderKey SHADER_KEY_FEATURES = 0xff;
+const ShaderKey SHADER_KEY_ALL = ~(ShaderKey) 0;
+
+inline ShaderKey shader_key(uint32_t features, unsigned int pointLights, unsigned int spotLights, uint32_t shadowMask,
+                            ShadowFilter filter, ShadowTechnique technique) {
+    return (ShaderKey) (features & 0xff)
+         | (ShaderKey) (pointLights & 0xf) << 8
+         | (ShaderKey) (spotLights & 0xf) << 12
+         | (ShaderKey) (shadowMask & 0xffff) << 16
+         | (ShaderKey) (filter & 0x3) << 32
+         | (ShaderKey) (technique & 0x1) << 34;
+}
+
+inline std::string shader_defines(ShaderKey key) {
+    const char *features[] = {"FADE", "FADED_ONLY", "EVENT_LIGHTS", "CLUSTERED_LIGHTS", "LIGHT_LISTS", "OIT", "UNFADED_ONLY"};
+    std::string defines;
+    for (int i = 0; i < 7; i++) {
+        if (key & (1u << i))
+            defines += fmt::format("#define {}\n", features[i]);
+    }
+    defines += fmt::format("#define NUM_POINT_LIGHTS {}\n", (key >> 8) & 0xf);
+    defines += fmt::format("#define NUM_SPOTLIGHTS {}\n", (key >> 12) & 0xf);
+    defines += fmt::format("#define SHADOW_MASK {}\n", (key >> 16) & 0xffff);
+    defines += fmt::format("#define SHADOW_FILTER {}\n", (key >> 32) & 0x3);
+    defines += fmt::format("#define SHADOW_TECHNIQUE {}\n", (key >> 34) & 0x1);
+    return defines;
+}
+
+// Specialized variants of one shader program, compiled on first use and cached
+// by key. The frame key carries what's fixed for a frame (lights, shadows),
+// each draw adds its own features. relevantBits drops the key bits a program
+// doesn't read, so e.g. the G-buffer shader isn't recompiled per light setup.
+class ShaderVariants {
+public:
+    ShaderVariants(std::string _vertexPath, std::string _fragmentPath, ShaderKey _relevantBits = SHADER_KEY_ALL);
+    // variants used from now on are configured by the callback once, on their first use in the frame;
+    // it's kept by reference, so it has to live until the next begin_frame
+    void begin_frame(ShaderKey _frameKey, const std::function<void(Shader &)> &_configure);
+    // a temporary, e.g. a lambda passed directly, would dangle
+    void begin_frame(ShaderKey, std::function<void(Shader &)> &&) = delete;
+    // activates the variant for this draw
+    Shader &use(uint32_t drawFeatures = 0);
+    size_t size() const { return variants.size(); }
+
+private:
+    struct Variant {
+        std::unique_ptr<Shader> shader;
+        unsigned int frame; // last frame the variant was configured in
+    };
+
+    std::string vertexPath;
+    std::string fragmentPath;
+    ShaderKey relevantBits;
+    std::unordered_map<ShaderKey, Variant> variants;
+    ShaderKey frameKey;
+    const std::function<void(Shader &)> *configure;
+    unsigned int frame;
+};
+
+ShaderVariants::ShaderVariants(std::string _vertexPath, std::string _fragmentPath, ShaderKey _relevantBits) :
+    vertexPath(std::move(_vertexPath)),
+    fragmentPath(std::move(_fragmentPath)),
+    relevantBits(_relevantBits),
+    frameKey(0),
+    configure(nullptr),
+    frame(0) {}
+
+void ShaderVariants::begin_frame(ShaderKey _frameKey, const std::function<void(Shader &)> &_configure) {
+    frameKey = _frameKey;
+    configure = &_configure;
+    frame++;
+}
+
+Shader &ShaderVariants::use(uint32_t drawFeatures) {
+    ShaderKey key = (frameKey | drawFeatures) & relevantBits;
+    auto found = variants.find(key);
+    if (found == variants.end()) {
+        // a new variant is a one-off, e.g. after a setting changed
+        AllowAllocations allow;
+        std::cout << fmt::format("Compiling {} variant {:#x}", fragmentPath, key) << std::endl;
+        auto shader = std::make_unique<Shader>(vertexPath.c_str(), fragmentPath.c_str(), nullptr, shader_defines(key));
+        found = variants.emplace(key, Variant{std::move(shader), 0}).first;
+    }
+    Variant &variant = found->second;
+    variant.shader->use();
+    if (variant.frame != frame) {
+        variant.frame = frame;
+        if (configure && *configure)
+            (*configure)(*variant.shader);
+    }
+    return *variant.shader;
+}
+
+#endif //PROJECT_BASE_SHADER_VARIANTS_HPP
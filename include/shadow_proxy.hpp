@@ -0,0 +1,123 @@
+#ifndef PROJECT_BASE_SHADOW_PROXY_HPP
+#define PROJECT_BASE_SHADOW_PROXY_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <learnopengl/mesh.h>
+#include <render_stats.hpp>
+
+// Simplified, position-only stand-in for a model, drawn by the depth passes.
+// Shadow silhouettes tolerate heavy simplification, and one small mesh with
+// 16-bit indices replaces every full-detail mesh of the model.
+struct ShadowProxy {
+    unsigned int VAO;
+    unsigned int VBO;
+    unsigned int EBO;
+    unsigned int indexCount;
+    unsigned int sourceTriangles;
+
+    ShadowProxy() : VAO(0), VBO(0), EBO(0), indexCount(0), sourceTriangles(0) {};
+
+    bool empty() const { return indexCount == 0; }
+
+    void draw() const {
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, (GLsizei) indexCount, GL_UNSIGNED_SHORT, 0);
+        glBindVertexArray(0);
+        render_stats().drawCalls++;
+        render_stats().vertexArrayBinds++;
+    }
+};
+
+// Vertex clustering: snaps vertices to a uniform grid and merges every cell into
+// its mean position, dropping the triangles that collapse. maxError is the
+// largest allowed vertex displacement as a fraction of the bounding box diagonal;
+// the grid is coarsened further if the result would not fit 16-bit indices.
+ShadowProxy build_shadow_proxy(const vector<Mesh> &meshes, float maxError) {
+    ShadowProxy proxy;
+    glm::vec3 lo(INFINITY), hi(-INFINITY);
+    for (const Mesh &mesh : meshes) {
+        for (const Vertex &vertex : mesh.vertices) {
+            lo = glm::min(lo, vertex.Position);
+            hi = glm::max(hi, vertex.Position);
+        }
+        proxy.sourceTriangles += (unsigned int) mesh.indices.size() / 3;
+    }
+    if (proxy.sourceTriangles == 0)
+        return proxy;
+
+    // the mean of a cell is at most one cell diagonal away from any of its vertices
+    float cell = glm::max(maxError * glm::length(hi - lo) / std::sqrt(3.0f), 1e-6f);
+    std::vector<glm::vec3> positions;
+    std::vector<uint16_t> indices;
+    while (true) {
+        std::unordered_map<uint64_t, uint32_t> clusters;
+        std::vector<glm::vec3> sums;
+        std::vector<float> counts;
+        std::vector<std::vector<uint32_t>> remap(meshes.size());
+        for (unsigned int m = 0; m < meshes.size(); m++) {
+            for (const Vertex &vertex : meshes[m].vertices) {
+                glm::vec3 cellPosition = (vertex.Position - lo) / cell;
+                uint64_t key = ((uint64_t) cellPosition.x << 42) | ((uint64_t) cellPosition.y << 21) | (uint64_t) cellPosition.z;
+                auto found = clusters.find(key);
+                uint32_t cluster;
+                if (found == clusters.end()) {
+                    cluster = (uint32_t) sums.size();
+                    clusters.emplace(key, cluster);
+                    sums.emplace_back(0.0f);
+                    counts.push_back(0.0f);
+                } else {
+                    cluster = found->second;
+                }
+                sums[cluster] += vertex.Position;
+                counts[cluster] += 1.0f;
+                remap[m].push_back(cluster);
+            }
+        }
+        if (sums.size() > 0xffff) {
+            cell *= 1.25f;
+            continue;
+        }
+
+        positions.resize(sums.size());
+        for (unsigned int i = 0; i < sums.size(); i++)
+            positions[i] = sums[i] / counts[i];
+        indices.clear();
+        for (unsigned int m = 0; m < meshes.size(); m++) {
+            const vector<unsigned int> &source = meshes[m].indices;
+            for (unsigned int i = 0; i + 2 < source.size(); i += 3) {
+                uint32_t a = remap[m][source[i]], b = remap[m][source[i + 1]], c = remap[m][source[i + 2]];
+                if (a == b || b == c || a == c)
+                    continue;
+                indices.push_back((uint16_t) a);
+                indices.push_back((uint16_t) b);
+                indices.push_back((uint16_t) c);
+            }
+        }
+        break;
+    }
+    if (indices.empty())
+        return proxy;
+
+    glGenVertexArrays(1, &proxy.VAO);
+    glGenBuffers(1, &proxy.VBO);
+    glGenBuffers(1, &proxy.EBO);
+    glBindVertexArray(proxy.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, proxy.VBO);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, proxy.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), &indices[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glBindVertexArray(0);
+    proxy.indexCount = (unsigned int) indices.size();
+    return proxy;
+}
+
+#endif //PROJECT_BASE_SHADOW_PROXY_HPP
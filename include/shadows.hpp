@@ -0,0 +1,535 @@
+#ifndef PROJECT_BASE_SHADOWS_HPP
+#define PROJECT_BASE_SHADOWS_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <learnopengl/shader.h>
+
+// Soft shadow filter quality tiers, values match SHADOW_FILTER_* in object.frag.
+// Every tier samples the depth cubemaps through samplerCubeShadow, so each tap
+// is already a hardware-compared 2x2 bilinear PCF lookup.
+enum ShadowFilter {
+    SHADOW_FILTER_HARDWARE = 0, // single hardware-compared tap
+    SHADOW_FILTER_POISSON_8,    // rotated Poisson disk, 8 taps
+    SHADOW_FILTER_POISSON_16,   // rotated Poisson disk, 16 taps
+    SHADOW_FILTER_POISSON_32,   // rotated Poisson disk, 32 taps
+    SHADOW_FILTER_COUNT
+};
+
+inline const char *shadow_filter_name(ShadowFilter filter) {
+    switch (filter) {
+        case SHADOW_FILTER_HARDWARE:   return "hardware";
+        case SHADOW_FILTER_POISSON_8:  return "poisson 8";
+        case SHADOW_FILTER_POISSON_16: return "poisson 16";
+        case SHADOW_FILTER_POISSON_32: return "poisson 32";
+        default:                       return "unknown";
+    }
+}
+
+inline ShadowFilter next_shadow_filter(ShadowFilter filter) {
+    return (ShadowFilter) (((int) filter + 1) % SHADOW_FILTER_COUNT);
+}
+
+// Shadow techniques, values match SHADOW_TECHNIQUE_* in object.frag.
+enum ShadowTechnique {
+    SHADOW_TECHNIQUE_PCF = 0, // depth cubemaps filtered with ShadowFilter
+    SHADOW_TECHNIQUE_ESM,     // prefiltered exponential shadow maps, one fetch per light
+    SHADOW_TECHNIQUE_COUNT
+};
+
+inline const char *shadow_technique_name(ShadowTechnique technique) {
+    switch (technique) {
+        case SHADOW_TECHNIQUE_PCF: return "pcf";
+        case SHADOW_TECHNIQUE_ESM: return "esm";
+        default:                   return "unknown";
+    }
+}
+
+inline ShadowTechnique next_shadow_technique(ShadowTechnique technique) {
+    return (ShadowTechnique) (((int) technique + 1) % SHADOW_TECHNIQUE_COUNT);
+}
+
+// ESM stores exp(c * depth), with depth = light distance / far_plane in [0, 1].
+// exp(80) still fits comfortably in a 32-bit float.
+const float ESM_EXPONENT = 80.0f;
+
+// fills the six cube face view-projection matrices of a point light
+void shadow_transforms(glm::vec3 position, const glm::mat4 &projection, glm::mat4 transforms[6]) {
+    transforms[0] = projection * glm::lookAt(position, position + glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f));
+    transforms[1] = projection * glm::lookAt(position, position + glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f));
+    transforms[2] = projection * glm::lookAt(position, position + glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f));
+    transforms[3] = projection * glm::lookAt(position, position + glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f));
+    transforms[4] = projection * glm::lookAt(position, position + glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f));
+    transforms[5] = projection * glm::lookAt(position, position + glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f));
+}
+
+unsigned int create_cubemap(unsigned int size, GLenum internalFormat, GLenum format, GLenum type, bool compare) {
+    unsigned int cubemap;
+    glGenTextures(1, &cubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    for (unsigned int j = 0; j < 6; ++j) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, 0, (GLint) internalFormat, (GLsizei) size, (GLsizei) size, 0, format, type, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    if (compare) {
+        // hardware depth comparison with bilinear filtering gives 2x2 PCF per tap
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    }
+    return cubemap;
+}
+
+// Shadow cubemaps of a single light. PCF renders into the depth cubemap, ESM
+// renders exp(c * depth) into a lower resolution raw moment cubemap that is
+// blurred into the sampled one. The moment cubemaps only exist while the map
+// uses ESM, see set_technique. Faces are cached and re-rendered individually
+// by ShadowScheduler when the light or the casters in them moved.
+class ShadowMap {
+public:
+    unsigned int depthFBO;
+    unsigned int depthCubemap;
+    unsigned int size;
+
+    unsigned int momentFBO;
+    unsigned int momentRawCubemap;
+    unsigned int momentCubemap;
+    unsigned int momentDepthCubemap;
+    unsigned int momentSize;
+
+    // single face target used for amortized updates, attachments are set per face
+    unsigned int faceFBO;
+
+    GLenum depthFormat;
+    ShadowTechnique technique;
+    // the light is enabled and casts shadows, inactive maps are never scheduled
+    bool active;
+
+    // per face cache state
+    bool faceValid[6];
+    glm::vec3 facePosition[6]; // light position the face was rendered from
+    float casterMotion[6];     // caster movement since the face was rendered
+    unsigned int faceAge[6];   // frames since the face was rendered
+
+    ShadowMap(unsigned int _size, GLenum _depthFormat, unsigned int _momentSize);
+    void resize(unsigned int _size, GLenum _depthFormat);
+    // allocates the moment cubemaps for ESM and frees them otherwise, invalidates the faces
+    void set_technique(ShadowTechnique _technique);
+    size_t depth_bytes() const;
+    size_t moment_bytes() const;
+    void invalidate();
+    void bind_face(int face) const;
+    void mark_face_updated(int face, glm::vec3 position);
+};
+
+// bytes per texel the driver stores for a depth format, 24-bit depth is padded to 32 bits
+inline size_t depth_format_bytes(GLenum depthFormat) {
+    return depthFormat == GL_DEPTH_COMPONENT16 ? 2 : 4;
+}
+
+inline size_t cubemap_bytes(unsigned int size, size_t texelBytes) {
+    return (size_t) size * size * 6 * texelBytes;
+}
+
+ShadowMap::ShadowMap(unsigned int _size, GLenum _depthFormat, unsigned int _momentSize) :
+    size(_size),
+    momentSize(_momentSize),
+    depthFormat(_depthFormat),
+    technique(SHADOW_TECHNIQUE_PCF),
+    active(true) {
+
+    depthCubemap = create_cubemap(size, depthFormat, GL_DEPTH_COMPONENT, GL_FLOAT, true);
+    glGenFramebuffers(1, &depthFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemap, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    momentRawCubemap = momentCubemap = momentDepthCubemap = 0;
+    glGenFramebuffers(1, &momentFBO);
+    glGenFramebuffers(1, &faceFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    invalidate();
+}
+
+// reallocates the depth cubemap storage, the FBO attachment stays valid
+void ShadowMap::resize(unsigned int _size, GLenum _depthFormat) {
+    size = _size;
+    depthFormat = _depthFormat;
+    glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
+    for (unsigned int j = 0; j < 6; ++j) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, 0, (GLint) depthFormat, (GLsizei) size, (GLsizei) size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    }
+    invalidate();
+}
+
+void ShadowMap::set_technique(ShadowTechnique _technique) {
+    technique = _technique;
+    invalidate();
+    bool moments = technique == SHADOW_TECHNIQUE_ESM;
+    if (moments == (momentCubemap != 0))
+        return;
+    if (moments) {
+        // layered rendering needs every attachment to be layered, so ESM gets its own depth cubemap
+        momentRawCubemap = create_cubemap(momentSize, GL_R32F, GL_RED, GL_FLOAT, false);
+        momentCubemap = create_cubemap(momentSize, GL_R32F, GL_RED, GL_FLOAT, false);
+        momentDepthCubemap = create_cubemap(momentSize, GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT, GL_FLOAT, false);
+    } else {
+        const unsigned int textures[] = {momentRawCubemap, momentCubemap, momentDepthCubemap};
+        glDeleteTextures(3, textures);
+        momentRawCubemap = momentCubemap = momentDepthCubemap = 0;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, momentFBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentRawCubemap, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, momentDepthCubemap, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+size_t ShadowMap::depth_bytes() const {
+    return cubemap_bytes(size, depth_format_bytes(depthFormat));
+}
+
+size_t ShadowMap::moment_bytes() const {
+    if (momentCubemap == 0)
+        return 0;
+    return 2 * cubemap_bytes(momentSize, 4) + cubemap_bytes(momentSize, depth_format_bytes(GL_DEPTH_COMPONENT16));
+}
+
+void ShadowMap::invalidate() {
+    for (int face = 0; face < 6; face++) {
+        faceValid[face] = false;
+        facePosition[face] = glm::vec3(0.0f);
+        casterMotion[face] = 0.0f;
+        faceAge[face] = 0;
+    }
+}
+
+// attaches a single cube face of the current technique to faceFBO and binds it
+void ShadowMap::bind_face(int face) const {
+    glBindFramebuffer(GL_FRAMEBUFFER, faceFBO);
+    if (technique == SHADOW_TECHNIQUE_ESM) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, momentRawCubemap, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, momentDepthCubemap, 0);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    } else {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, depthCubemap, 0);
+        glDrawBuffer(GL_NONE);
+    }
+}
+
+void ShadowMap::mark_face_updated(int face, glm::vec3 position) {
+    faceValid[face] = true;
+    facePosition[face] = position;
+    casterMotion[face] = 0.0f;
+    faceAge[face] = 0;
+}
+
+// What a light's shadow has to cover: the region it lights (receiver sphere)
+// seen from the light, used to size its cubemap.
+struct ShadowRequest {
+    glm::vec3 lightPosition;
+    glm::vec3 receiverCenter;
+    float receiverRadius;
+};
+
+// Sizes the depth cubemaps of all lights to fit a global memory budget. Each
+// light asks for the resolution at which one cubemap texel covers about one
+// screen pixel of its receiver region; 24-bit depth is used only if all lights
+// fit, otherwise 16-bit, and the least important lights are halved until the
+// budget holds. The ESM moment cubemaps count against the budget as well, the
+// depth cubemaps get what they leave. Every light keeps its own cubemap as its
+// slot in the atlas.
+class ShadowAtlas {
+public:
+    size_t budget;
+    unsigned int minSize;
+    unsigned int maxSize;
+
+    ShadowAtlas(size_t _budget, unsigned int _minSize, unsigned int _maxSize);
+    // plans sizes for the current view and applies them, returns true if any map was reallocated
+    bool update(std::vector<ShadowMap> &maps, const std::vector<ShadowRequest> &requests,
+                glm::vec3 cameraPosition, float fovY, int screenHeight, float time);
+    size_t bytes_in_use(const std::vector<ShadowMap> &maps) const;
+    // lets the next update re-plan at once, e.g. after the limits changed
+    void replan() { lastChange = -INFINITY; }
+    // memory saved compared to fixed 2048^2 32-bit depth cubemaps
+    size_t bytes_saved(const std::vector<ShadowMap> &maps) const;
+
+private:
+    float lastChange;
+    // planned per light, kept so planning doesn't allocate
+    std::vector<unsigned int> sizes;
+    std::vector<float> importance;
+};
+
+ShadowAtlas::ShadowAtlas(size_t _budget, unsigned int _minSize, unsigned int _maxSize) :
+    budget(_budget),
+    minSize(_minSize),
+    maxSize(_maxSize),
+    lastChange(-INFINITY) {}
+
+bool ShadowAtlas::update(std::vector<ShadowMap> &maps, const std::vector<ShadowRequest> &requests,
+                         glm::vec3 cameraPosition, float fovY, int screenHeight, float time) {
+    // don't thrash allocations while the camera moves, re-plan at most twice a second
+    if (time - lastChange < 0.5f)
+        return false;
+
+    sizes.resize(requests.size());
+    importance.resize(requests.size());
+    for (unsigned int i = 0; i < requests.size(); i++) {
+        const ShadowRequest &request = requests[i];
+        // screen pixels spanned by the receiver sphere
+        float cameraDistance = glm::length(request.receiverCenter - cameraPosition);
+        float screenPixels = (float) screenHeight;
+        if (cameraDistance > request.receiverRadius)
+            screenPixels = glm::min(screenPixels, request.receiverRadius / (cameraDistance * std::tan(glm::radians(fovY) * 0.5f)) * (float) screenHeight);
+        // fraction of a 90 degree cube face the receiver sphere spans from the light
+        float lightDistance = glm::length(request.receiverCenter - request.lightPosition);
+        float faceFraction = 1.0f;
+        if (lightDistance > request.receiverRadius)
+            faceFraction = glm::min(1.0f, 2.0f * std::atan(request.receiverRadius / lightDistance) / glm::radians(90.0f));
+
+        float wanted = screenPixels / faceFraction;
+        unsigned int size = minSize;
+        while (size < maxSize && (float) size < wanted)
+            size *= 2;
+        sizes[i] = size;
+        importance[i] = screenPixels;
+    }
+
+    auto total = [&](size_t texelBytes) {
+        size_t bytes = 0;
+        for (unsigned int size : sizes)
+            bytes += cubemap_bytes(size, texelBytes);
+        return bytes;
+    };
+    // the ESM moment cubemaps have a fixed size, the depth cubemaps get the rest
+    size_t momentBytes = 0;
+    for (const ShadowMap &map : maps)
+        momentBytes += map.moment_bytes();
+    size_t depthBudget = budget > momentBytes ? budget - momentBytes : 0;
+    GLenum depthFormat = GL_DEPTH_COMPONENT24;
+    if (total(depth_format_bytes(depthFormat)) > depthBudget)
+        depthFormat = GL_DEPTH_COMPONENT16;
+    while (total(depth_format_bytes(depthFormat)) > depthBudget) {
+        // halve the least important light that can still shrink
+        int victim = -1;
+        for (unsigned int i = 0; i < sizes.size(); i++) {
+            if (sizes[i] > minSize && (victim < 0 || importance[i] / (float) sizes[i] < importance[victim] / (float) sizes[victim]))
+                victim = (int) i;
+        }
+        if (victim < 0)
+            break;
+        sizes[victim] /= 2;
+    }
+
+    bool changed = false;
+    for (unsigned int i = 0; i < maps.size() && i < sizes.size(); i++) {
+        if (maps[i].size != sizes[i] || maps[i].depthFormat != depthFormat) {
+            maps[i].resize(sizes[i], depthFormat);
+            changed = true;
+        }
+    }
+    if (changed)
+        lastChange = time;
+    return changed;
+}
+
+size_t ShadowAtlas::bytes_in_use(const std::vector<ShadowMap> &maps) const {
+    size_t bytes = 0;
+    for (const ShadowMap &map : maps)
+        bytes += map.depth_bytes() + map.moment_bytes();
+    return bytes;
+}
+
+size_t ShadowAtlas::bytes_saved(const std::vector<ShadowMap> &maps) const {
+    size_t baseline = maps.size() * cubemap_bytes(2048, 4);
+    size_t inUse = bytes_in_use(maps);
+    return baseline > inUse ? baseline - inUse : 0;
+}
+
+// true if a sphere, relative to the light, overlaps the frustum of a cube face
+inline bool sphere_in_cube_face(int face, glm::vec3 center, float radius) {
+    int axis = face / 2;
+    float sign = face % 2 == 0 ? 1.0f : -1.0f;
+    float along = sign * center[axis];
+    // the four side planes of the face pyramid pass through the light at 45 degrees
+    float margin = radius * 1.41421356f;
+    for (int other = 0; other < 3; other++) {
+        if (other == axis)
+            continue;
+        if (along - center[other] < -margin || along + center[other] < -margin)
+            return false;
+    }
+    return true;
+}
+
+struct ShadowFaceUpdate {
+    unsigned int map;
+    int face;
+    float priority;
+};
+
+// Amortizes shadow map updates for moving lights: every frame it hands out at
+// most facesPerFrame stale cube faces, most important first. A face becomes
+// stale when its light or a caster inside it moves; its priority grows with
+// that movement, with its age and with whether the region it covers is on
+// screen. Faces that can't see the scene are never rendered after their first
+// update. The caller stops early once timeBudget seconds of shadow work are spent.
+class ShadowScheduler {
+public:
+    int facesPerFrame; // 0 updates every stale face
+    float timeBudget;
+    glm::vec3 sceneCenter;
+    float sceneRadius;
+
+    ShadowScheduler(int _facesPerFrame, float _timeBudget, glm::vec3 _sceneCenter, float _sceneRadius);
+    // marks the faces of every light that a moved caster (bounding sphere) falls into
+    void casters_moved(std::vector<ShadowMap> &maps, const std::vector<glm::vec3> &lightPositions,
+                       glm::vec3 center, float radius) const;
+    // fills updates, which keeps its capacity from frame to frame
+    void schedule(std::vector<ShadowMap> &maps, const std::vector<glm::vec3> &lightPositions,
+                  const glm::mat4 &viewProjection, ShadowTechnique technique, std::vector<ShadowFaceUpdate> &updates) const;
+};
+
+ShadowScheduler::ShadowScheduler(int _facesPerFrame, float _timeBudget, glm::vec3 _sceneCenter, float _sceneRadius) :
+    facesPerFrame(_facesPerFrame),
+    timeBudget(_timeBudget),
+    sceneCenter(_sceneCenter),
+    sceneRadius(_sceneRadius) {}
+
+void ShadowScheduler::casters_moved(std::vector<ShadowMap> &maps, const std::vector<glm::vec3> &lightPositions,
+                                    glm::vec3 center, float radius) const {
+    for (unsigned int i = 0; i < maps.size() && i < lightPositions.size(); i++) {
+        for (int face = 0; face < 6; face++) {
+            if (sphere_in_cube_face(face, center - lightPositions[i], radius))
+                maps[i].casterMotion[face] += 1.0f;
+        }
+    }
+}
+
+void ShadowScheduler::schedule(std::vector<ShadowMap> &maps, const std::vector<glm::vec3> &lightPositions,
+                               const glm::mat4 &viewProjection, ShadowTechnique technique, std::vector<ShadowFaceUpdate> &updates) const {
+    const glm::vec3 axes[6] = {
+        glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(-1.0f,  0.0f,  0.0f),
+        glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3( 0.0f, -1.0f,  0.0f),
+        glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3( 0.0f,  0.0f, -1.0f)
+    };
+    updates.clear();
+    for (unsigned int i = 0; i < maps.size() && i < lightPositions.size(); i++) {
+        ShadowMap &map = maps[i];
+        // inactive maps switch too, their moments are bound for shading all the same
+        if (map.technique != technique)
+            map.set_technique(technique);
+        if (!map.active)
+            continue;
+        glm::vec3 toScene = sceneCenter - lightPositions[i];
+        for (int face = 0; face < 6; face++) {
+            map.faceAge[face]++;
+            if (!map.faceValid[face]) {
+                // never rendered, the face holds garbage
+                updates.push_back({i, face, INFINITY});
+                continue;
+            }
+            if (!sphere_in_cube_face(face, toScene, sceneRadius))
+                continue;
+            float motion = glm::length(lightPositions[i] - map.facePosition[face]) + map.casterMotion[face];
+            if (motion <= 0.0f)
+                continue;
+            // is the part of the scene this face covers on screen
+            glm::vec4 clip = viewProjection * glm::vec4(lightPositions[i] + axes[face] * glm::length(toScene), 1.0f);
+            bool onScreen = clip.w > 0.0f && std::abs(clip.x) < 1.2f * clip.w && std::abs(clip.y) < 1.2f * clip.w;
+            float visibility = onScreen ? 1.0f : 0.25f;
+            updates.push_back({i, face, motion * visibility * (1.0f + 0.1f * (float) map.faceAge[face])});
+        }
+    }
+    std::sort(updates.begin(), updates.end(), [](const ShadowFaceUpdate &a, const ShadowFaceUpdate &b) {
+        return a.priority > b.priority;
+    });
+    if (facesPerFrame > 0 && updates.size() > (size_t) facesPerFrame)
+        updates.resize(facesPerFrame);
+}
+
+// Separable gaussian blur of ESM moment cubemaps. The horizontal pass reads the
+// raw cubemap, so it filters across face seams, and writes into a 6 layer
+// scratch array; the vertical pass writes the result into the sampled cubemap.
+// Only the faces in faceMask are blurred, so partial updates never blur twice.
+class MomentBlur {
+public:
+    explicit MomentBlur(unsigned int _size);
+    void apply(const ShadowMap &map, Shader &shader, unsigned int faceMask = 0x3f) const;
+
+private:
+    unsigned int size;
+    unsigned int FBO;
+    unsigned int scratch;
+    unsigned int VAO; // empty, the fullscreen triangle is generated from gl_VertexID
+};
+
+MomentBlur::MomentBlur(unsigned int _size) : size(_size) {
+    glGenTextures(1, &scratch);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, scratch);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, (GLsizei) size, (GLsizei) size, 6, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenFramebuffers(1, &FBO);
+    glGenVertexArrays(1, &VAO);
+}
+
+void MomentBlur::apply(const ShadowMap &map, Shader &shader, unsigned int faceMask) const {
+    glViewport(0, 0, (GLsizei) size, (GLsizei) size);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindVertexArray(VAO);
+
+    shader.use();
+    shader.setInt("momentCube", 0);
+    shader.setInt("momentLayers", 1);
+    shader.setFloat("texelSize", 1.0f / (float) size);
+    // each pass has only its source bound, sampling a texture while rendering
+    // into it is a feedback loop
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, map.momentRawCubemap);
+    for (int face = 0; face < 6; face++) {
+        if (!(faceMask & (1u << face)))
+            continue;
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, scratch, 0, face);
+        shader.setInt("face", face);
+        shader.setInt("vertical", 0);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, scratch);
+    for (int face = 0; face < 6; face++) {
+        if (!(faceMask & (1u << face)))
+            continue;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, map.momentCubemap, 0);
+        shader.setInt("face", face);
+        shader.setInt("vertical", 1);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+}
+
+#endif //PROJECT_BASE_SHADOWS_HPP
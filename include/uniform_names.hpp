@@ -0,0 +1,26 @@
+#ifndef PROJECT_BASE_UNIFORM_NAMES_HPP
+#define PROJECT_BASE_UNIFORM_NAMES_HPP
+
+#include <fmt/core.h>
+
+#include <map>
+#include <string>
+#include <utility>
+
+#include <allocations.hpp>
+
+// The pattern with the index filled in, e.g. "pointLights[{}].position",
+// formatted on first use and looked up from then on, so setting array uniforms
+// doesn't build strings every frame. Keyed by the pattern's address, so it
+// has to be a literal.
+inline const char *indexed_name(const char *pattern, unsigned int index) {
+    static std::map<std::pair<const char *, unsigned int>, std::string> names;
+    auto found = names.find(std::make_pair(pattern, index));
+    if (found == names.end()) {
+        AllowAllocations allow;
+        found = names.emplace(std::make_pair(pattern, index), fmt::format(fmt::runtime(pattern), index)).first;
+    }
+    return found->second.c_str();
+}
+
+#endif //PROJECT_BASE_UNIFORM_NAMES_HPP
@@ -0,0 +1,21 @@
+#version 410 core
+out vec4 FragColor;
+
+flat in int lightIndex;
+
+#include "lighting.glsl"
+#include "gbuffer.glsl"
+
+// one event light for the pixels inside its volume, added to the framebuffer
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0)
+        discard;
+    vec4 albedoSpec = texelFetch(gAlbedoSpec, pixel, 0);
+    vec3 normal = OctDecode(texelFetch(gNormal, pixel, 0).rg);
+    vec3 fragPos = ReconstructPosition(gl_FragCoord.xy, depth);
+    vec3 viewDir = normalize(viewPosition - fragPos);
+    FragColor = vec4(CalcEventLight(lightIndex, normal, fragPos, viewDir, albedoSpec.rgb, vec3(albedoSpec.a)), 1.0);
+}
@@ -0,0 +1,38 @@
+#version 410 core
+
+// screen-space light volume: one quad per event light (instance) covering the
+// projection of its range sphere, placed at the sphere's nearest depth
+uniform samplerBuffer eventLightData;
+uniform mat4 view;
+uniform mat4 projection;
+uniform float cameraNear;
+
+flat out int lightIndex;
+
+void main()
+{
+    lightIndex = gl_InstanceID;
+    vec4 positionRange = texelFetch(eventLightData, gl_InstanceID * 4);
+    vec3 center = vec3(view * vec4(positionRange.xyz, 1.0));
+    float radius = positionRange.w;
+
+    // the whole screen if the sphere crosses the near plane
+    vec2 lo = vec2(-1.0), hi = vec2(1.0);
+    float depth = -1.0;
+    if (-center.z - radius > cameraNear) {
+        lo = vec2(1.0);
+        hi = vec2(-1.0);
+        for (int i = 0; i < 8; i++) {
+            vec3 corner = center + radius * vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1) * 2.0 - radius;
+            vec4 clip = projection * vec4(corner, 1.0);
+            lo = min(lo, clip.xy / clip.w);
+            hi = max(hi, clip.xy / clip.w);
+        }
+        lo = clamp(lo, -1.0, 1.0);
+        hi = clamp(hi, -1.0, 1.0);
+        vec4 front = projection * vec4(center.xy, center.z + radius, 1.0);
+        depth = front.z / front.w;
+    }
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    gl_Position = vec4(mix(lo, hi, corner), depth, 1.0);
+}
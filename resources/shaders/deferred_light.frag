@@ -0,0 +1,21 @@
+#version 410 core
+out vec4 FragColor;
+
+#include "lighting.glsl"
+#include "gbuffer.glsl"
+
+// fullscreen pass: ambient and the shadowed lights, which reach the whole board.
+// Also writes the G-buffer depth, the light volumes and forward passes test against it.
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0)
+        discard;
+    vec4 albedoSpec = texelFetch(gAlbedoSpec, pixel, 0);
+    vec3 normal = OctDecode(texelFetch(gNormal, pixel, 0).rg);
+    vec3 fragPos = ReconstructPosition(gl_FragCoord.xy, depth);
+    vec3 viewDir = normalize(viewPosition - fragPos);
+    FragColor = vec4(ShadeSurface(normal, fragPos, viewDir, albedoSpec.rgb, vec3(albedoSpec.a)), 1.0);
+    gl_FragDepth = depth;
+}
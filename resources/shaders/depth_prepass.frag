@@ -0,0 +1,15 @@
+#version 410 core
+
+in vec3 FragPos;
+
+uniform vec3 cameraPos;
+
+// depth only; faded fragments next to the camera stay out of the depth
+// buffer, like in the opaque lighting pass, they are blended afterwards
+void main()
+{
+#ifdef FADE
+    if (length(FragPos-cameraPos) / 1.5 < 1.0)
+        discard;
+#endif
+}
@@ -0,0 +1,18 @@
+#version 410 core
+layout (location = 0) in vec3 aPos;
+
+out vec3 FragPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// must compute the position exactly like object.vert, the lighting pass
+// depth tests against what this pass wrote
+invariant gl_Position;
+
+void main()
+{
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,36 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform samplerCube momentCube;
+uniform sampler2DArray momentLayers;
+uniform float texelSize;
+uniform int face;
+uniform bool vertical;
+
+const float weights[3] = float[](0.402620, 0.244201, 0.054489);
+
+// direction through a cube face texel, following the GL cube map face layout
+vec3 CubeDirection(int face, vec2 uv)
+{
+    vec2 st = uv * 2.0 - 1.0;
+    if (face == 0) return vec3( 1.0, -st.y, -st.x);
+    if (face == 1) return vec3(-1.0, -st.y,  st.x);
+    if (face == 2) return vec3( st.x,  1.0,  st.y);
+    if (face == 3) return vec3( st.x, -1.0, -st.y);
+    if (face == 4) return vec3( st.x, -st.y,  1.0);
+    return vec3(-st.x, -st.y, -1.0);
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * texelSize;
+    float moment = 0.0;
+    for (int i = -2; i <= 2; i++) {
+        float weight = weights[abs(i)];
+        if (vertical)
+            moment += weight * texture(momentLayers, vec3(uv + vec2(0.0, i * texelSize), face)).r;
+        else
+            moment += weight * texture(momentCube, CubeDirection(face, uv + vec2(i * texelSize, 0.0))).r;
+    }
+    FragColor = vec4(moment);
+}
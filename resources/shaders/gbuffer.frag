@@ -0,0 +1,31 @@
+#version 410 core
+layout (location = 0) out vec4 gAlbedoSpecOut;
+layout (location = 1) out vec2 gNormalOut;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+
+uniform Material material;
+uniform vec3 cameraPos;
+
+#include "gbuffer.glsl"
+
+void main()
+{
+#ifdef FADE
+    // fragments faded next to the camera are blended by the translucent pass afterwards
+    if (length(FragPos-cameraPos) / 1.5 < 1.0)
+        discard;
+#endif
+    vec3 albedo = vec3(texture(material.diffuse, TexCoords));
+    vec3 specularColor = albedo;
+    gAlbedoSpecOut = vec4(albedo, dot(specularColor, vec3(1.0 / 3.0)));
+    gNormalOut = OctEncode(normalize(Normal));
+}
@@ -0,0 +1,30 @@
+// G-buffer layout and decoding, see GBuffer in gbuffer.hpp
+uniform sampler2D gAlbedoSpec;  // rgb albedo, a specular intensity
+uniform sampler2D gNormal;      // octahedral encoded normal
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+
+// unit vector to [0, 1]^2, folding the lower hemisphere over the upper one
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
+vec3 OctDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+// world position of a pixel from its stored depth
+vec3 ReconstructPosition(vec2 fragCoord, float depth)
+{
+    vec3 ndc = vec3(fragCoord / vec2(textureSize(gDepth, 0)), depth) * 2.0 - 1.0;
+    vec4 position = inverseViewProjection * vec4(ndc, 1.0);
+    return position.xyz / position.w;
+}
@@ -0,0 +1,20 @@
+#version 330 core
+out float FarthestDepth;
+
+// bound with only the level to read, its base level, so lod 0 here
+uniform sampler2D source;
+uniform ivec2 sourceSize;
+
+// one level of the occlusion pyramid: the farthest depth of the 2x2 source
+// texels below, and of the extra row or column left over by an odd size
+void main()
+{
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+    ivec2 last = sourceSize - 1;
+    ivec2 span = ivec2(base.x + 2 == last.x ? 2 : 1, base.y + 2 == last.y ? 2 : 1);
+    float depth = 0.0;
+    for (int y = 0; y <= span.y; y++)
+        for (int x = 0; x <= span.x; x++)
+            depth = max(depth, texelFetch(source, min(base + ivec2(x, y), last), 0).r);
+    FarthestDepth = depth;
+}
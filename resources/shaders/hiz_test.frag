@@ -0,0 +1,6 @@
+#version 330 core
+
+// only counted by the occlusion query, writes nothing
+void main()
+{
+}
@@ -0,0 +1,45 @@
+#version 330 core
+
+uniform vec3 boundsMin;
+uniform vec3 boundsMax;
+uniform mat4 viewProjection;
+uniform sampler2D hiZ;
+uniform ivec2 hiZSize; // of level 0, half the screen
+uniform int hiZLevels;
+
+// Occlusion test of one box against the pyramid of hiz_reduce.frag. The point
+// lands on screen, and passes the instance's query, unless the box's nearest
+// depth lies behind the farthest occluder depth over its whole screen rectangle.
+void main()
+{
+    vec3 ndcMin = vec3(1.0);
+    vec3 ndcMax = vec3(-1.0);
+    bool visible = false;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = mix(boundsMin, boundsMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+        vec4 clip = viewProjection * vec4(corner, 1.0);
+        // crosses the near plane, can't be projected, keep it
+        if (clip.z < -clip.w)
+            visible = true;
+        vec3 ndc = clip.xyz / max(clip.w, 1e-6);
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    if (!visible) {
+        // a level 0 texel of margin absorbs rounding, then pick the level where
+        // the rectangle spans at most two texels each way
+        vec2 margin = 1.0 / vec2(hiZSize);
+        vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5 - margin, 0.0, 1.0);
+        vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5 + margin, 0.0, 1.0);
+        vec2 size = (uvMax - uvMin) * vec2(hiZSize);
+        int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0)))), 0, hiZLevels - 1);
+        ivec2 levelSize = max(hiZSize >> level, ivec2(1));
+        ivec2 lo = min(ivec2(uvMin * vec2(levelSize)), levelSize - 1);
+        ivec2 hi = min(ivec2(uvMax * vec2(levelSize)), levelSize - 1);
+        float occluderDepth = max(max(texelFetch(hiZ, lo, level).r, texelFetch(hiZ, ivec2(hi.x, lo.y), level).r),
+                                  max(texelFetch(hiZ, ivec2(lo.x, hi.y), level).r, texelFetch(hiZ, hi, level).r));
+        visible = ndcMin.z * 0.5 + 0.5 <= occluderDepth;
+    }
+    gl_Position = visible ? vec4(0.0, 0.0, 0.0, 1.0) : vec4(2.0, 2.0, 2.0, 1.0);
+}
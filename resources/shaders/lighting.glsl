@@ -0,0 +1,308 @@
+// Lighting shared by the forward (object.frag) and deferred (deferred_*.frag)
+// pipelines, so both shade with the same code. Surface colors are passed in
+// rather than sampled here.
+//
+// Light counts, the lights that cast shadows and the shadow filter are compile
+// time constants, injected per variant by ShaderVariants (shader_variants.hpp).
+// The light arrays hold only the enabled lights.
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS 0
+#endif
+#ifndef NUM_SPOTLIGHTS
+#define NUM_SPOTLIGHTS 0
+#endif
+// bit i set: light i casts shadows, point lights first, then spotlights
+#ifndef SHADOW_MASK
+#define SHADOW_MASK 0
+#endif
+
+struct PointLight {
+    vec3 position;
+
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+#define NUM_LIGHTS (NUM_POINT_LIGHTS + NUM_SPOTLIGHTS)
+// arrays can't be empty, unused slots are never read
+uniform PointLight pointLights[NUM_POINT_LIGHTS > 0 ? NUM_POINT_LIGHTS : 1];
+uniform SpotLight spotLights[NUM_SPOTLIGHTS > 0 ? NUM_SPOTLIGHTS : 1];
+
+#ifdef LIGHT_LISTS
+// slots of the lights reaching the current draw, points first, see LightCuller
+uniform int drawLightCount;
+uniform int drawLights[NUM_LIGHTS > 0 ? NUM_LIGHTS : 1];
+#endif
+
+uniform Material material;
+uniform vec3 viewPosition;
+
+uniform float far_plane;
+
+// shadow filter quality tiers, kept in sync with ShadowFilter in shadows.hpp
+#define SHADOW_FILTER_HARDWARE 0
+#define SHADOW_FILTER_POISSON_8 1
+#define SHADOW_FILTER_POISSON_16 2
+#define SHADOW_FILTER_POISSON_32 3
+#ifndef SHADOW_FILTER
+#define SHADOW_FILTER SHADOW_FILTER_POISSON_16
+#endif
+
+// shadow techniques, kept in sync with ShadowTechnique in shadows.hpp
+#define SHADOW_TECHNIQUE_PCF 0
+#define SHADOW_TECHNIQUE_ESM 1
+#ifndef SHADOW_TECHNIQUE
+#define SHADOW_TECHNIQUE SHADOW_TECHNIQUE_PCF
+#endif
+
+#if SHADOW_TECHNIQUE == SHADOW_TECHNIQUE_ESM
+uniform samplerCube momentMaps[NUM_LIGHTS > 0 ? NUM_LIGHTS : 1];
+uniform float esmExponent;
+#else
+uniform samplerCubeShadow depthMaps[NUM_LIGHTS > 0 ? NUM_LIGHTS : 1];
+#endif
+
+// progressive Poisson disk: every prefix of 8/16/32 taps is well distributed,
+// and the first 4 taps form the ring used for the early exit
+const vec2 poissonDisk[32] = vec2[](
+    vec2( 0.42990,  0.13298), vec2(-0.13298,  0.42990),
+    vec2(-0.42990, -0.13298), vec2( 0.13298, -0.42990),
+    vec2(-0.85855,  0.48178), vec2(-0.42758, -0.90205),
+    vec2( 0.44977,  0.79459), vec2( 0.90173, -0.42495),
+    vec2( 0.37892, -0.92425), vec2( 0.93150,  0.34544),
+    vec2(-0.89755, -0.42394), vec2(-0.11915,  0.98599),
+    vec2(-0.86236,  0.03770), vec2(-0.47158,  0.73343),
+    vec2(-0.01616, -0.00119), vec2(-0.02099, -0.96876),
+    vec2(-0.51463, -0.51869), vec2( 0.52816, -0.28379),
+    vec2(-0.51948,  0.30060), vec2( 0.97910, -0.04045),
+    vec2( 0.67277, -0.69659), vec2( 0.23274,  0.45138),
+    vec2(-0.16588, -0.64967), vec2( 0.56704,  0.44989),
+    vec2(-0.16740, -0.30322), vec2( 0.07939,  0.73102),
+    vec2( 0.27346, -0.12076), vec2(-0.28350,  0.12820),
+    vec2( 0.36419, -0.60547), vec2( 0.68459, -0.03074),
+    vec2(-0.70813, -0.18289), vec2( 0.78690,  0.61683)
+);
+
+// unshadowed event lights, see ClusterLight in clusters.hpp
+uniform int numEventLights;
+uniform samplerBuffer eventLightData;
+
+vec3 globalAmbient = vec3(0.0);
+
+// function prototypes
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor);
+vec3 CalcSpotAmbient(SpotLight light, vec3 fragPos, vec3 albedo);
+float ShadowCalculation(vec3 fragPos, int depthMapId, vec3 lightPos);
+vec3 CalcEventLight(int index, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor);
+
+// ambient plus every shadowed point and spot light
+vec3 ShadeSurface(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+    vec3 combined = vec3(0.0);
+#ifdef LIGHT_LISTS
+    // only the lights the CPU found to reach this draw
+    for(int k = 0; k < drawLightCount; k++) {
+        int i = drawLights[k];
+        if (i < 0) {
+            // a spotlight in range whose cone misses the draw, only its ambient reaches it
+            globalAmbient += CalcSpotAmbient(spotLights[-1 - i - NUM_POINT_LIGHTS], fragPos, albedo);
+            continue;
+        }
+        vec3 color;
+        vec3 lightPosition;
+        if (i < NUM_POINT_LIGHTS) {
+            color = CalcPointLight(pointLights[i], normal, fragPos, viewDir, albedo, specularColor);
+            lightPosition = pointLights[i].position;
+        } else {
+            color = CalcSpotLight(spotLights[i - NUM_POINT_LIGHTS], normal, fragPos, viewDir, albedo, specularColor);
+            lightPosition = spotLights[i - NUM_POINT_LIGHTS].position;
+        }
+        if ((SHADOW_MASK & (1 << i)) != 0)
+            color *= 1.0 - ShadowCalculation(fragPos, i, lightPosition);
+        combined += color;
+    }
+#else
+    // constant trip counts and masks: the loops unroll and unshadowed lights drop the shadow code
+    for(int i = 0; i < NUM_POINT_LIGHTS; i++) {
+        vec3 color = CalcPointLight(pointLights[i], normal, fragPos, viewDir, albedo, specularColor);
+        if ((SHADOW_MASK & (1 << i)) != 0)
+            color *= 1.0 - ShadowCalculation(fragPos, i, pointLights[i].position);
+        combined += color;
+    }
+    for(int i = 0; i < NUM_SPOTLIGHTS; i++) {
+        vec3 color = CalcSpotLight(spotLights[i], normal, fragPos, viewDir, albedo, specularColor);
+        if ((SHADOW_MASK & (1 << (NUM_POINT_LIGHTS + i))) != 0)
+            color *= 1.0 - ShadowCalculation(fragPos, NUM_POINT_LIGHTS+i, spotLights[i].position);
+        combined += color;
+    }
+#endif
+    return globalAmbient + combined;
+}
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    //float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+
+    globalAmbient += ambient;
+    return (diffuse + specular);
+}
+
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
+    ambient *= attenuation;
+    diffuse *= attenuation * intensity;
+    specular *= attenuation * intensity;
+
+    globalAmbient += ambient;
+    return (diffuse + specular);
+}
+
+// the ambient term of CalcSpotLight alone
+vec3 CalcSpotAmbient(SpotLight light, vec3 fragPos, vec3 albedo)
+{
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    return light.ambient * albedo * attenuation;
+}
+
+float ShadowCalculation(vec3 fragPos, int depthMapId, vec3 lightPos)
+{
+    vec3 fragToLight = fragPos - lightPos;
+    float bias = 0.05;
+    // depth maps store light distance / far_plane, compared in hardware (GL_LEQUAL)
+    float reference = (length(fragToLight) - bias) / far_plane;
+
+#if SHADOW_TECHNIQUE == SHADOW_TECHNIQUE_ESM
+    // prefiltered exp(c * occluder) against exp(-c * receiver), one fetch
+    float moment = texture(momentMaps[depthMapId], fragToLight).r;
+    return 1.0 - clamp(moment * exp(-esmExponent * reference), 0.0, 1.0);
+#elif SHADOW_FILTER == SHADOW_FILTER_HARDWARE
+    return 1.0 - texture(depthMaps[depthMapId], vec4(fragToLight, reference));
+#else
+#if SHADOW_FILTER == SHADOW_FILTER_POISSON_8
+    const int samples = 8;
+#elif SHADOW_FILTER == SHADOW_FILTER_POISSON_16
+    const int samples = 16;
+#else
+    const int samples = 32;
+#endif
+
+    // offset taps in the plane perpendicular to the lookup direction,
+    // with the disk rotated per pixel to trade banding for noise
+    vec3 direction = normalize(fragToLight);
+    vec3 up = abs(direction.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, direction));
+    vec3 bitangent = cross(direction, tangent);
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    float diskRadius = 0.02;
+
+    float lit = 0.0;
+    for (int i = 0; i < samples; i++) {
+        vec2 offset = rotation * poissonDisk[i] * diskRadius;
+        lit += texture(depthMaps[depthMapId], vec4(fragToLight + tangent * offset.x + bitangent * offset.y, reference));
+        // the first ring agrees: fragment is fully lit or fully in shadow
+        if (i == 3 && (lit == 0.0 || lit == 4.0))
+            return 1.0 - lit / 4.0;
+    }
+    return 1.0 - lit / float(samples);
+#endif
+}
+
+// event lights only add diffuse and specular, they have no ambient or shadows
+vec3 CalcEventLight(int index, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+    vec4 positionRange = texelFetch(eventLightData, index * 4);
+    vec4 colorType = texelFetch(eventLightData, index * 4 + 1);
+    vec4 attenuationOuter = texelFetch(eventLightData, index * 4 + 2);
+    vec4 directionInner = texelFetch(eventLightData, index * 4 + 3);
+
+    vec3 toLight = positionRange.xyz - fragPos;
+    float distance = length(toLight);
+    // the same cut-off the clusters are built with, so both paths match
+    if (distance > positionRange.w)
+        return vec3(0.0);
+    vec3 lightDir = toLight / distance;
+
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec;
+    float intensity = 1.0;
+    if (colorType.w > 0.5) {
+        spec = pow(max(dot(viewDir, reflect(-lightDir, normal)), 0.0), material.shininess);
+        float theta = dot(lightDir, normalize(-directionInner.xyz));
+        intensity = clamp((theta - attenuationOuter.w) / (directionInner.w - attenuationOuter.w), 0.0, 1.0);
+    } else {
+        spec = pow(max(dot(normal, normalize(lightDir + viewDir)), 0.0), material.shininess);
+    }
+    float attenuation = 1.0 / (attenuationOuter.x + attenuationOuter.y * distance + attenuationOuter.z * (distance * distance));
+
+    vec3 diffuse = colorType.rgb * diff * albedo;
+    vec3 specular = colorType.rgb * spec * specularColor;
+    return (diffuse + specular) * attenuation * intensity;
+}
+
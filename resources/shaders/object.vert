@@ -11,6 +11,9 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// matches depth_prepass.vert bit for bit
+invariant gl_Position;
+
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
@@ -0,0 +1,18 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D oitAccum;
+uniform sampler2D oitWeight;
+
+// weighted average of the translucent fragments, blended over the opaque scene
+// by how much of it they let through, see OITBuffer in oit.hpp
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(oitAccum, texel, 0);
+    float revealage = accum.a;
+    if (revealage == 1.0)
+        discard;
+    float weight = texelFetch(oitWeight, texel, 0).r;
+    FragColor = vec4(accum.rgb / clamp(weight, 1e-4, 5e4), 1.0 - revealage);
+}
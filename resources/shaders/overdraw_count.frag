@@ -0,0 +1,9 @@
+#version 410 core
+out vec4 FragColor;
+
+// one more shaded fragment, added up by glBlendFunc(GL_ONE, GL_ONE), see
+// OverdrawBuffer in overdraw.hpp
+void main()
+{
+    FragColor = vec4(1.0);
+}
@@ -0,0 +1,20 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D overdrawCounts;
+
+// fragments shaded per pixel: none black, 1 blue, 2 green, 3 yellow, 4 orange,
+// 5 or more red, brightening towards white at 10
+void main()
+{
+    const vec3 ramp[6] = vec3[](
+        vec3(0.0), vec3(0.0, 0.2, 1.0), vec3(0.0, 0.8, 0.2),
+        vec3(1.0, 0.9, 0.0), vec3(1.0, 0.5, 0.0), vec3(1.0, 0.0, 0.0)
+    );
+    float count = texelFetch(overdrawCounts, ivec2(gl_FragCoord.xy), 0).r;
+    int index = int(min(count, 5.0));
+    vec3 color = ramp[index];
+    if (count > 5.0)
+        color = mix(color, vec3(1.0), min((count - 5.0) / 5.0, 1.0));
+    FragColor = vec4(color, 1.0);
+}
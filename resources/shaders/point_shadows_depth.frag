@@ -1,8 +1,11 @@
 #version 330 core
 in vec4 FragPos;
 
+out vec4 FragColor;
+
 uniform vec3 lightPos;
 uniform float far_plane;
+uniform float esmExponent;
 
 void main()
 {
@@ -13,4 +16,7 @@ void main()
     
     // write this as modified depth
     gl_FragDepth = lightDistance;
-}
\ No newline at end of file
+
+    // exponential shadow map moment, ignored when no color buffer is attached
+    FragColor = vec4(exp(esmExponent * lightDistance));
+}
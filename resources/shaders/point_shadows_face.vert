@@ -0,0 +1,15 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 shadowMatrix;
+
+out vec4 FragPos;
+
+// renders a single cube face, used instead of the layered geometry shader
+// path when only some faces of a shadow map need an update
+void main()
+{
+    FragPos = model * vec4(aPos, 1.0);
+    gl_Position = shadowMatrix * FragPos;
+}
@@ -0,0 +1,51 @@
+#include <allocations.hpp>
+
+#include <new>
+
+// The replacements of the global allocation functions, see allocations.hpp.
+// They live in their own translation unit: defined once per executable, and
+// out of sight of the code calling new and delete, which the compiler would
+// otherwise see pairing malloc with operator delete.
+
+void *operator new(std::size_t size) {
+    void *memory = counted_allocation(size);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return counted_allocation(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return counted_allocation(size);
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
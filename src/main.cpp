@@ -6,24 +6,87 @@
 
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
-#include <numeric>
+#include <random>
+#include <set>
+#include <string>
 
 #include <learnopengl/filesystem.h>
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
 
+#include <allocations.hpp>
+#include <benchmark.hpp>
 #include <board.hpp>
+#include <clusters.hpp>
+#include <cpu_profiler.hpp>
+#include <frame_arena.hpp>
+#include <frame_stats.hpp>
+#include <frustum_culling.hpp>
+#include <gbuffer.hpp>
+#include <gpu_queries.hpp>
+#include <light_culling.hpp>
 #include <lights.hpp>
+#include <occlusion_culling.hpp>
+#include <oit.hpp>
+#include <overdraw.hpp>
+#include <picking.hpp>
+#include <scene.hpp>
+#include <shader_variants.hpp>
+#include <shadows.hpp>
+#include <uniform_names.hpp>
 
 void loadPieceModels();
 
-void renderScene(Shader &shader);
+void syncScene(Scene &scene, Board &board, int boardIndex, glm::vec3 offset);
+
+glm::vec3 boardOffset(int boardIndex, int boards);
+
+void setupScalingCell(const ScalingCell &cell, ShadowAtlas &shadowAtlas);
+
+void runSceneBenchmark();
+
+template<typename Enum>
+bool parseSetting(const string &value, Enum count, const char *(*name)(Enum), Enum &setting);
+
+bool parseInt(const string &value, int &result);
+
+bool pickSquare(glm::vec3 origin, glm::vec3 direction, int &row, char &col);
+
+void renderScene(const vector<SceneInstance> &instances, const FrustumCuller &culler, Shader &shader, bool shadowPass = false);
+
+void renderOpaque(const vector<SceneInstance> &instances, const FrustumCuller &culler, ShaderVariants &variants, LightCuller *lightCuller = nullptr,
+                  const OcclusionCuller *occlusionCuller = nullptr);
+
+void renderTranslucent(const vector<SceneInstance> &instances, const FrustumCuller &culler, ShaderVariants &variants, LightCuller *lightCuller = nullptr);
 
 void renderLights(Shader &shader);
 
+void renderHighlight(Shader &shader, int row, char col);
+
+ShaderKey lightingKey();
+
+void setLightUniforms(Shader &shader, const vector<ShadowMap> &shadowMaps, float farPlane);
+
+void writeAllocationSummary(std::ostream &out, uint64_t since);
+
+void generateEventLights(int count);
+
+void animateEventLights(float time);
+
+void shadowRequests(vector<ShadowRequest> &requests);
+
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 
 void window_size_callback(GLFWwindow *window, int width, int height);
@@ -51,11 +114,58 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
+// camera clip planes, shared by the projection and the light clusters
+const float CAMERA_NEAR = 0.1f;
+const float CAMERA_FAR = 100.0f;
+
+// upper bound for the event light count, keys + and - double and halve it
+const int MAX_EVENT_LIGHTS = 1024;
+
+// frames before --assert-no-alloc starts checking: shader variants, caches and
+// scratch buffers are filled by then
+const unsigned int ALLOCATION_CHECK_WARMUP = 120;
+
+// frames --occlusion-check compares on its own, with --benchmark it checks all of those
+const unsigned int OCCLUSION_CHECK_FRAMES = 30;
+
+// starting size of each half of the frame arena, it grows to what frames need
+const size_t FRAME_ARENA_SIZE = 64u << 10;
+
+// largest vertex displacement of shadow proxies, as a fraction of the model size
+const float SHADOW_PROXY_ERROR = 0.01f;
+
+// surfaces closer than this to the camera fade out, must match object.frag
+const float FADE_DISTANCE = 1.5f;
+
 // program state
 bool hideLights = false;
 bool hideCursor = true;
 bool printFps = false;
-vector <float> prev_fps(20, 0.0f);
+ShadowFilter shadowFilter = SHADOW_FILTER_POISSON_16;
+ShadowTechnique shadowTechnique = SHADOW_TECHNIQUE_PCF;
+bool animateLights = false;
+int shadowFacesPerFrame = 0;
+int shadowFacesUpdated = 0;
+bool clusteredLighting = true;
+RenderPipeline renderPipeline = RENDER_PIPELINE_FORWARD;
+bool cullLights = true;
+bool depthPrepass = false;
+bool measureOverdraw = false;
+// overdraw heatmap instead of the shaded scene: off, or the draw order to count
+enum OverdrawView { OVERDRAW_VIEW_OFF, OVERDRAW_VIEW_FRONT_TO_BACK, OVERDRAW_VIEW_BACK_TO_FRONT };
+OverdrawView overdrawView = OVERDRAW_VIEW_OFF;
+bool frustumCulling = true;
+bool occlusionCulling = false;
+CullStats cameraCullStats; // meshes of the last frame, per pass
+CullStats shadowCullStats;
+int hoveredRow = 0; // square under the cursor, row 0 if none
+char hoveredCol = 0;
+float pickMicroseconds = 0.0f;
+int eventLightCount = 0;
+FrameStats frameStats;
+AllocationCounts frameAllocations; // heap allocations of the last frame
+AllocationCounts totalFrameAllocations;
+FrameArena frameArena(FRAME_ARENA_SIZE); // scratch memory of the frame, draw lists and the like
 
 std::map<string, std::shared_ptr<Model>> pieceModels;
 std::unique_ptr<Model> model_board;
@@ -64,14 +174,144 @@ Board board;
 Camera camera;
 vector <PointLight> pointLights;
 vector <SpotLight> spotLights;
+vector <PointLight> eventLights; // small unshadowed lights, shaded through the clusters
+Scene scene;
+Picker picker;
+GpuProfiler gpuProfiler;
+CpuProfiler cpuProfiler;
+
+int main(int argc, char **argv) {
+    // --light-sweep renders the scene with 0 to 1024 event lights through both
+    // lighting paths and prints the mean frame times as CSV
+    // --scene-benchmark times the scene queries with 1, 16 and 256 boards and exits
+    // --gpu-profile <file> times the render passes on the GPU and writes them as CSV
+    // --cpu-trace <file> writes the CPU zones of the last frames as a Chrome trace at exit
+    // --scaling-sweep renders every combination of 1, 4 and 16 boards, 0 and 256
+    //   event lights, 256 and 1024 shadow maps, three shadow filters and culling
+    //   on and off, and prints frame times, draw calls and state changes as CSV
+    // --benchmark renders a scripted camera orbit offscreen and writes the timings
+    //   as JSON, set up by --benchmark-frames <n>, --benchmark-output <file>,
+    //   --resolution <w>x<h>, --lights <n>, --pipeline forward|deferred,
+    //   --shadows pcf|esm, --shadow-filter hardware|poisson8|poisson16|poisson32
+    //   and --shadow-faces <faces per frame, 0 for all>
+    // --assert-no-alloc aborts on the first heap allocation of the frame loop
+    //   once it is warm, printing the CPU zone it came from
+    // --pipeline-stats counts vertices, primitives and shader invocations of every
+    //   render pass and prints them every second, needs GL_ARB_pipeline_statistics_query
+    // --occlusion-check renders the default scene offscreen with occlusion culling,
+    //   compares the instances it keeps with those visible without it, and exits
+    //   with 1 if it culled a visible one
+    std::unique_ptr<LightCountSweep> lightSweep;
+    std::unique_ptr<SceneScalingSweep> scalingSweep;
+    bool sceneBenchmark = false;
+    std::ofstream gpuProfileCsv;
+    string cpuTracePath;
+    bool benchmark = false;
+    bool assertNoAllocations = false;
+    bool pipelineStatistics = false;
+    std::unique_ptr<OcclusionCheck> occlusionCheck;
+    int benchmarkFrames = 300;
+    string benchmarkOutput = "benchmark.json";
+    // flags followed by a value
+    const std::set<string> valueFlags = {"--benchmark-frames", "--benchmark-output", "--resolution", "--lights", "--pipeline",
+                                         "--shadows", "--shadow-filter", "--shadow-faces", "--cpu-trace", "--gpu-profile"};
+    for (int i = 1; i < argc; i++) {
+        string flag = argv[i];
+        string value;
+        if (valueFlags.count(flag)) {
+            if (i + 1 >= argc) {
+                std::cout << fmt::format("Missing value for {}", flag) << std::endl;
+                return -1;
+            }
+            value = argv[++i];
+        }
+        bool parsed = true;
+        if (flag == "--benchmark")
+            benchmark = true;
+        else if (flag == "--benchmark-frames")
+            parsed = parseInt(value, benchmarkFrames) && benchmarkFrames >= 1;
+        else if (flag == "--benchmark-output")
+            benchmarkOutput = value;
+        else if (flag == "--resolution")
+            parsed = std::sscanf(value.c_str(), "%dx%d", &SCR_WIDTH, &SCR_HEIGHT) == 2 && SCR_WIDTH > 0 && SCR_HEIGHT > 0;
+        else if (flag == "--lights")
+            parsed = parseInt(value, eventLightCount) && eventLightCount >= 0 && eventLightCount <= MAX_EVENT_LIGHTS;
+        else if (flag == "--pipeline")
+            parsed = parseSetting(value, RENDER_PIPELINE_COUNT, render_pipeline_name, renderPipeline);
+        else if (flag == "--shadows")
+            parsed = parseSetting(value, SHADOW_TECHNIQUE_COUNT, shadow_technique_name, shadowTechnique);
+        else if (flag == "--shadow-filter")
+            parsed = parseSetting(value, SHADOW_FILTER_COUNT, shadow_filter_name, shadowFilter);
+        else if (flag == "--shadow-faces")
+            parsed = parseInt(value, shadowFacesPerFrame) && shadowFacesPerFrame >= 0;
+        else if (flag == "--cpu-trace")
+            cpuTracePath = value;
+        else if (flag == "--gpu-profile") {
+            gpuProfileCsv.open(value);
+            gpuProfiler.enabled = true;
+            gpuProfiler.write_csv(&gpuProfileCsv);
+        } else if (flag == "--light-sweep")
+            lightSweep = std::make_unique<LightCountSweep>(std::vector<int>{0, 16, 64, 256, 1024}, 30, 120);
+        else if (flag == "--scene-benchmark")
+            sceneBenchmark = true;
+        else if (flag == "--assert-no-alloc")
+            assertNoAllocations = true;
+        else if (flag == "--pipeline-stats")
+            pipelineStatistics = true;
+        else if (flag == "--occlusion-check")
+            occlusionCheck = std::make_unique<OcclusionCheck>();
+        else if (flag == "--scaling-sweep")
+            scalingSweep = std::make_unique<SceneScalingSweep>(std::vector<int>{1, 4, 16}, std::vector<int>{0, 256},
+                                                               std::vector<unsigned int>{256, 1024},
+                                                               std::vector<ShadowFilter>{SHADOW_FILTER_HARDWARE, SHADOW_FILTER_POISSON_8, SHADOW_FILTER_POISSON_32},
+                                                               10, 60);
+        else {
+            std::cout << fmt::format("Unknown argument {}", flag) << std::endl;
+            return -1;
+        }
+        if (!parsed) {
+            std::cout << fmt::format("Unknown value {} for {}", value, flag) << std::endl;
+            return -1;
+        }
+    }
+    std::unique_ptr<FrameBenchmark> frameBenchmark;
+    if (benchmark) {
+        frameBenchmark = std::make_unique<FrameBenchmark>(60, benchmarkFrames);
+        // the averages span exactly the measured frames
+        gpuProfiler = GpuProfiler(4, (unsigned int) benchmarkFrames);
+        gpuProfiler.enabled = true;
+    }
+    if (occlusionCheck) {
+        // occlusion culling only serves the forward pipeline
+        renderPipeline = RENDER_PIPELINE_FORWARD;
+        occlusionCulling = true;
+    }
+    bool offscreen = benchmark || occlusionCheck;
 
-int main() {
-
-    glfwInit();
+#ifdef GLFW_PLATFORM_NULL
+    // GLFW 3.4 runs without a display server, rendering through OSMesa (e.g. Mesa's
+    // llvmpipe); older versions only hide the window and still need one, e.g. Xvfb
+    if (offscreen)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+    if (!glfwInit()) {
+        std::cout << "Failed to initialize GLFW" << std::endl;
+        return -1;
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_SAMPLES, 4);
+    if (offscreen) {
+        // offscreen contexts have no multisampled default framebuffer
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_SAMPLES, 0);
+#ifdef GLFW_PLATFORM_NULL
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#else
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#endif
+    }
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -104,9 +344,17 @@ int main() {
     glEnable(GL_CULL_FACE);
     glEnable(GL_BLEND);
 
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    if (lightSweep || scalingSweep || frameBenchmark)
+        glfwSwapInterval(0); // measure frame times, not the refresh rate
+
     glDepthFunc(GL_LESS);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    if (pipelineStatistics && !gpuProfiler.set_statistics(true))
+        std::cout << "GL_ARB_pipeline_statistics_query is not supported, --pipeline-stats is ignored" << std::endl;
+
     // initialize lights
     // -----------------
     pointLights = vector<PointLight>(1, PointLight());
@@ -135,9 +383,12 @@ int main() {
     spotLights[2].set_light(glm::vec3(0, 8, 0));
     spotLights[2].enabled = true;
 
+    generateEventLights(MAX_EVENT_LIGHTS);
+
     // build and compile shaders
     // -------------------------
-    Shader objectShader(
+    // lit shaders are specialized per light setup and per draw, see shader_variants.hpp
+    ShaderVariants objectShader(
         "resources/shaders/object.vert",
         "resources/shaders/object.frag"
     );
@@ -147,188 +398,701 @@ int main() {
         "resources/shaders/point_shadows_depth.frag",
         "resources/shaders/point_shadows_depth.geom"
     );
+    Shader depthFaceShader(
+        "resources/shaders/point_shadows_face.vert",
+        "resources/shaders/point_shadows_depth.frag"
+    );
     Shader lightShader(
         "resources/shaders/light.vert",
         "resources/shaders/light.frag"
     );
+    Shader blurShader(
+        "resources/shaders/fullscreen.vert",
+        "resources/shaders/esm_blur.frag"
+    );
+    ShaderVariants gBufferShader(
+        "resources/shaders/object.vert",
+        "resources/shaders/gbuffer.frag",
+        SHADER_FEATURE_FADE
+    );
+    ShaderVariants depthPrepassShader(
+        "resources/shaders/depth_prepass.vert",
+        "resources/shaders/depth_prepass.frag",
+        SHADER_FEATURE_FADE
+    );
+    ShaderVariants deferredLightShader(
+        "resources/shaders/fullscreen.vert",
+        "resources/shaders/deferred_light.frag",
+        SHADER_KEY_ALL & ~SHADER_KEY_FEATURES
+    );
+    Shader deferredEventShader(
+        "resources/shaders/deferred_event.vert",
+        "resources/shaders/deferred_event.frag"
+    );
+    Shader oitCompositeShader(
+        "resources/shaders/fullscreen.vert",
+        "resources/shaders/oit_composite.frag"
+    );
+    Shader hiZReduceShader(
+        "resources/shaders/fullscreen.vert",
+        "resources/shaders/hiz_reduce.frag"
+    );
+    Shader hiZTestShader(
+        "resources/shaders/hiz_test.vert",
+        "resources/shaders/hiz_test.frag"
+    );
+    Shader overdrawCountShader(
+        "resources/shaders/depth_prepass.vert",
+        "resources/shaders/overdraw_count.frag"
+    );
+    Shader overdrawHeatmapShader(
+        "resources/shaders/fullscreen.vert",
+        "resources/shaders/overdraw_heatmap.frag"
+    );
 
-    // configure depth map FBO
-    // -----------------------
-    const unsigned int SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
-    unsigned int depthMapFBOs[pointLights.size()+spotLights.size()];
-    unsigned int depthCubemaps[pointLights.size()+spotLights.size()];
+    // configure shadow maps
+    // ---------------------
+    // depth cubemap sizes are picked per light by the atlas to fit the memory budget
+    const size_t SHADOW_MEMORY_BUDGET = 64u << 20;
+    const unsigned int SHADOW_MIN_SIZE = 256, SHADOW_MAX_SIZE = 2048;
+    const unsigned int ESM_SIZE = 512;
+    ShadowAtlas shadowAtlas(SHADOW_MEMORY_BUDGET, SHADOW_MIN_SIZE, SHADOW_MAX_SIZE);
+    vector <ShadowMap> shadowMaps;
     for(unsigned int i = 0; i < pointLights.size()+spotLights.size(); i++) {
-        glGenFramebuffers(1, depthMapFBOs + i);
-        glGenTextures(1, depthCubemaps + i);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemaps[i]);
-        for (unsigned int j = 0; j < 6; ++j) {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-        }
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        // attach depth texture as FBO's depth buffer
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBOs[i]);
-        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemaps[i], 0);
-        glDrawBuffer(GL_NONE);
-        glReadBuffer(GL_NONE);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        shadowMaps.emplace_back(SHADOW_MIN_SIZE, GL_DEPTH_COMPONENT16, ESM_SIZE);
     }
+    MomentBlur momentBlur(ESM_SIZE);
+    // stale cube faces are re-rendered round-robin, within 2 ms of shadow work per frame
+    ShadowScheduler shadowScheduler(shadowFacesPerFrame, 0.002f, glm::vec3(0.0f), 6.0f);
+
+    // configure light clusters
+    // ------------------------
+    LightClusters lightClusters(CAMERA_NEAR, CAMERA_FAR);
+    vector <ClusterLight> clusterLights;
+    clusterLights.reserve(MAX_EVENT_LIGHTS);
+
+    // configure deferred shading
+    // --------------------------
+    LightCuller lightCuller;
+    FrustumCuller frustumCuller;
+    OcclusionCuller occlusionCuller(SCR_WIDTH, SCR_HEIGHT);
+    GBuffer gBuffer(SCR_WIDTH, SCR_HEIGHT);
+    OITBuffer oitBuffer(SCR_WIDTH, SCR_HEIGHT);
+    OverdrawBuffer overdrawBuffer(SCR_WIDTH, SCR_HEIGHT);
+    unsigned int emptyVAO; // fullscreen triangle and light quads come from gl_VertexID
+    glGenVertexArrays(1, &emptyVAO);
+
+    // overdraw measurement: the forward pass alternates between with and without
+    // the depth prepass, counting the samples that reach the framebuffer
+    // --------------------------------------------------------------------------
+    QueryRing samplesQueries[2] = {QueryRing(GL_SAMPLES_PASSED), QueryRing(GL_SAMPLES_PASSED)};
+    double shadedSamples[2] = {0.0, 0.0};
+    unsigned int measuredFrames[2] = {0, 0};
+    float overdrawReportTime = 0.0f;
+    float statisticsReportTime = 0.0f;
+    GLint framebufferSamples = 0;
+    glGetIntegerv(GL_SAMPLES, &framebufferSamples);
+    unsigned int frameIndex = 0;
 
     // load models
     // -----------
+    uint64_t loadStart = CpuProfiler::now();
     model_board = std::make_unique<Model>("resources/objects/stone_board/model.obj");
+    model_board->GenerateShadowProxy(SHADOW_PROXY_ERROR);
     model_cube = std::make_unique<Model>("resources/objects/cube.obj");
+    cpuProfiler.record("load board", loadStart, CpuProfiler::now());
     loadPieceModels();
+    uint64_t pickMeshStart = CpuProfiler::now();
+    picker.add(model_board.get());
+    for(auto &pieceModel : pieceModels)
+        picker.add(pieceModel.second.get());
+    cpuProfiler.record("build pick meshes", pickMeshStart, CpuProfiler::now());
+    cpuProfiler.record("load models", loadStart, CpuProfiler::now());
+
+    if (sceneBenchmark) {
+        runSceneBenchmark();
+        glfwTerminate();
+        return 0;
+    }
 
     // initialize board & camera
     // -------------------------
     board = Board();
     camera = Camera(glm::vec3(0.0f, -9.0f, 9.0f));
+    Board shadowBoard = board; // board as last seen by the shadow maps
+    syncScene(scene, board, 0, glm::vec3(0.0f));
+    unsigned int sceneRevision = board.revision; // board as last seen by the scene
+
+    // per-frame state, kept out here so the frame loop doesn't allocate: the
+    // vectors keep their capacity, and the shader configure callbacks, whose
+    // std::function allocates for that many captures, are built once
+    // -------------------------------------------------------------------------
+    const float near_plane = 1.0f;
+    const float far_plane  = 25.0f;
+    const glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, near_plane, far_plane);
+    glm::mat4 projection, view, inverseViewProjection;
+    vector <ShadowRequest> requests;
+    vector <glm::vec3> lightPositions;
+    vector <ShadowFaceUpdate> faceUpdates;
+    // the G-buffer and the depth prepass
+    const std::function<void(Shader &)> configureGeometry = [&](Shader &shader) {
+        shader.setVec3("cameraPos", camera.Position);
+        shader.setMat4("projection", projection);
+        shader.setMat4("view", view);
+    };
+    const std::function<void(Shader &)> configureDeferredLighting = [&](Shader &shader) {
+        setLightUniforms(shader, shadowMaps, far_plane);
+        gBuffer.bind_textures(shader, 0);
+        shader.setMat4("inverseViewProjection", inverseViewProjection);
+    };
+    const std::function<void(Shader &)> configureForward = [&](Shader &shader) {
+        setLightUniforms(shader, shadowMaps, far_plane);
+        shader.setVec3("cameraPos", camera.Position);
+        lightClusters.bind(shader, 10);
+        shader.setVec2("screenSize", glm::vec2(SCR_WIDTH, SCR_HEIGHT));
+        shader.setMat4("projection", projection);
+        shader.setMat4("view", view);
+    };
+    lastFrame = (float) glfwGetTime(); // the first frame doesn't count the loading
+    uint64_t loopStart = CpuProfiler::now();
 
     while (!glfwWindowShouldClose(window)) {
+        CpuZone frameZone(cpuProfiler, "frame");
+        AllocationCounts frameStart = thread_allocations();
+        frameArena.begin_frame();
         auto currentFrame = (float) glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        prev_fps.erase(prev_fps.begin());
-        prev_fps.push_back(1.0f / deltaTime);
-        float avg_fps = std::accumulate(prev_fps.begin(), prev_fps.end(), 0.0f) / (float) prev_fps.size();
-        if (printFps)
-            glfwSetWindowTitle(window,fmt::format("RG projekat - Daniil Grbic - {:.2f} FPS", avg_fps).c_str());
-        else
+        frameStats.add(deltaTime);
+        thread_allocation_check().forbidden = assertNoAllocations && frameStats.total_frames() > ALLOCATION_CHECK_WARMUP;
+        if (lightSweep) {
+            AllowAllocations allow; // a result now and then
+            lightSweep->frame_finished(deltaTime);
+            if (lightSweep->done()) {
+                lightSweep->write_csv(std::cout);
+                glfwSetWindowShouldClose(window, true);
+                continue;
+            }
+            eventLightCount = lightSweep->light_count();
+            clusteredLighting = lightSweep->clustered();
+        }
+        if (scalingSweep) {
+            AllowAllocations allow; // a result and a new scene now and then
+            // nothing was rendered before the first iteration, which sets up the first cell
+            if (frameStats.total_frames() > 1)
+                scalingSweep->frame_finished(deltaTime, render_stats());
+            if (scalingSweep->done()) {
+                scalingSweep->write_csv(std::cout);
+                glfwSetWindowShouldClose(window, true);
+                continue;
+            }
+            if (scalingSweep->cell_started())
+                setupScalingCell(scalingSweep->cell(), shadowAtlas);
+            // every face is re-rendered every frame, shadows cost the most they can
+            shadowScheduler.timeBudget = INFINITY;
+            for(auto &shadowMap : shadowMaps)
+                shadowMap.invalidate();
+        }
+        render_stats() = RenderStats();
+        if (frameBenchmark) {
+            frameBenchmark->frame_finished(deltaTime, cameraCullStats, shadowCullStats);
+            if (frameBenchmark->done()) {
+                glfwSetWindowShouldClose(window, true);
+                continue;
+            }
+            glm::vec3 position;
+            float yaw, pitch;
+            frameBenchmark->camera_pose(position, yaw, pitch);
+            camera = Camera(position, glm::vec3(0.0f, 0.0f, 1.0f), yaw, pitch);
+        } else if (occlusionCheck && occlusionCheck->frames >= OCCLUSION_CHECK_FRAMES) {
+            glfwSetWindowShouldClose(window, true);
+            continue;
+        }
+
+        if (printFps) {
+            // formatted into a fixed buffer, the title is rebuilt every frame and must not allocate
+            static char title[1024];
+            char *out = title, *end = title + sizeof(title) - 1;
+            out = fmt::format_to_n(out, end - out, "RG projekat - Daniil Grbic - {:.2f} FPS, p99 {:.1f} ms, 1% low {:.0f} FPS - {} - shadows: {} {}, {:.1f} MB, {} faces/frame (max ",
+                                   1000.0f / frameStats.mean(20), frameStats.percentile(99.0f, 300), frameStats.one_percent_low_fps(300), render_pipeline_name(renderPipeline),
+                                   shadow_technique_name(shadowTechnique), shadow_filter_name(shadowFilter),
+                                   (float) shadowAtlas.bytes_in_use(shadowMaps) / (1 << 20), shadowFacesUpdated).out;
+            if (shadowFacesPerFrame)
+                out = fmt::format_to_n(out, end - out, "{}", shadowFacesPerFrame).out;
+            else
+                out = fmt::format_to_n(out, end - out, "all").out;
+            out = fmt::format_to_n(out, end - out, ") - {} event lights, {} ({} assignments) - light-draw pairs {}/{} - meshes drawn/culled: camera {}/{}, shadows {}/{} - occluded {}/{} - hover ",
+                                   eventLightCount, clusteredLighting ? "clustered" : "brute force",
+                                   lightClusters.assignments(), lightCuller.pairsKept, lightCuller.pairsTested,
+                                   cameraCullStats.drawn, cameraCullStats.culled, shadowCullStats.drawn, shadowCullStats.culled,
+                                   occlusionCuller.occluded, occlusionCuller.tested).out;
+            if (hoveredRow)
+                out = fmt::format_to_n(out, end - out, "{}{} {}", hoveredCol, hoveredRow, board.get_piece(hoveredRow, hoveredCol)).out;
+            else
+                out = fmt::format_to_n(out, end - out, "none").out;
+            out = fmt::format_to_n(out, end - out, " ({:.1f} us) - {} allocations ({} B)",
+                                   pickMicroseconds, frameAllocations.allocations, frameAllocations.bytes).out;
+            if (gpuProfiler.enabled)
+                out = gpuProfiler.summary(fmt::format_to_n(out, end - out, " - ").out, end);
+            *out = '\0';
+            glfwSetWindowTitle(window, title);
+        } else
             glfwSetWindowTitle(window, "RG projekat - Daniil Grbic");
 
-        processInput(window);
+        {
+            CpuZone zone(cpuProfiler, "processInput");
+            processInput(window);
+        }
+        gpuProfiler.begin_frame();
 
         glClearColor(0.02f, 0.0f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        float near_plane = 1.0f;
-        float far_plane  = 25.0f;
-        glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT, near_plane, far_plane);
-        std::vector<glm::mat4> shadowTransforms;
-
-        for(unsigned int i = 0; i < pointLights.size(); i++) {
-            // 0. create depth cube map transformation matrices
-            // ------------------------------------------------
-            shadowTransforms.clear();
-            shadowTransforms.push_back(shadowProj * glm::lookAt(pointLights[i].position, pointLights[i].position + glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(pointLights[i].position, pointLights[i].position + glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(pointLights[i].position, pointLights[i].position + glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(pointLights[i].position, pointLights[i].position + glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(pointLights[i].position, pointLights[i].position + glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(pointLights[i].position, pointLights[i].position + glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
-
-            // 1. render scene to depth cube map
-            // ---------------------------------
-            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBOs[i]);
-            glClear(GL_DEPTH_BUFFER_BIT);
-            depthShader.use();
-            for (unsigned int j = 0; j < 6; ++j) {
-                depthShader.setMat4(fmt::format("shadowMatrices[{}]", j), shadowTransforms[j]);
+        glm::mat4 shadowTransforms[6];
+
+        shadowRequests(requests);
+        if (shadowAtlas.update(shadowMaps, requests, camera.Position, camera.Zoom, SCR_HEIGHT, currentFrame)) {
+            AllowAllocations allow;
+            std::cout << fmt::format("Shadow atlas: {:.1f} MB in use (budget {:.1f} MB), {:.1f} MB saved, sizes:",
+                                     (float) shadowAtlas.bytes_in_use(shadowMaps) / (1 << 20),
+                                     (float) shadowAtlas.budget / (1 << 20),
+                                     (float) shadowAtlas.bytes_saved(shadowMaps) / (1 << 20));
+            for(auto &shadowMap : shadowMaps)
+                std::cout << fmt::format(" {}/{}bit", shadowMap.size, shadowMap.depthFormat == GL_DEPTH_COMPONENT16 ? 16 : 24);
+            std::cout << std::endl;
+        }
+
+        if (animateLights) {
+            // disco mode: the spotlight rig spins around the board
+            glm::mat4 spin = glm::rotate(glm::mat4(1.0f), deltaTime * 0.8f, glm::vec3(0.0f, 0.0f, 1.0f));
+            for(auto &spotLight : spotLights) {
+                spotLight.position = glm::vec3(spin * glm::vec4(spotLight.position, 1.0f));
+                spotLight.direction = glm::vec3(spin * glm::vec4(spotLight.direction, 0.0f));
             }
-            depthShader.setFloat("far_plane", far_plane);
-            depthShader.setVec3("lightPos", pointLights[i].position);
-            renderScene(depthShader);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            animateEventLights(currentFrame);
+        }
+
+        lightPositions.clear();
+        for(auto &pointLight : pointLights) {
+            shadowMaps[lightPositions.size()].active = pointLight.enabled && pointLight.castShadows;
+            lightPositions.push_back(pointLight.position);
+        }
+        for(auto &spotLight : spotLights) {
+            shadowMaps[lightPositions.size()].active = spotLight.enabled && spotLight.castShadows;
+            lightPositions.push_back(spotLight.position);
         }
 
-        for(unsigned int i = 0; i < spotLights.size(); i++) {
-            // 0. create depth cube map transformation matrices
-            // ------------------------------------------------
-            shadowTransforms.clear();
-            shadowTransforms.push_back(shadowProj * glm::lookAt(spotLights[i].position, spotLights[i].position + glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(spotLights[i].position, spotLights[i].position + glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(spotLights[i].position, spotLights[i].position + glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(spotLights[i].position, spotLights[i].position + glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(spotLights[i].position, spotLights[i].position + glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(spotLights[i].position, spotLights[i].position + glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
-
-            // 1. render scene to depth cube map
-            // ---------------------------------
-            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBOs[pointLights.size()+i]);
+        projection = glm::perspective(
+            glm::radians(camera.Zoom),
+            (float) SCR_WIDTH / (float) SCR_HEIGHT,
+            CAMERA_NEAR,
+            CAMERA_FAR
+        );
+        view = camera.GetViewMatrix();
+
+        // assign the event lights to the view frustum clusters they touch
+        clusterLights.clear();
+        for(int i = 0; i < eventLightCount; i++)
+            clusterLights.push_back(cluster_light(eventLights[i]));
+        lightClusters.update(clusterLights, view, camera.Zoom, (float) SCR_WIDTH / (float) SCR_HEIGHT);
+
+        // pieces that changed since the last frame make the faces they fall into stale
+        if (board.revision != shadowBoard.revision) {
+            AllowAllocations allow; // a move, not the steady state
+            for(int row = 1; row <= 8; row++) {
+                for (char col = 'a'; col <= 'h'; col++) {
+                    if (board.get_piece(row, col) != shadowBoard.get_piece(row, col))
+                        shadowScheduler.casters_moved(shadowMaps, lightPositions, Board::get_position(row, col) + glm::vec3(0.0f, 0.0f, 0.5f), 0.75f);
+                }
+            }
+            shadowBoard = board;
+        }
+
+        // draw list of the frame
+        if (board.revision != sceneRevision) {
+            AllowAllocations allow;
+            syncScene(scene, board, 0, glm::vec3(0.0f));
+            sceneRevision = board.revision;
+        }
+
+        // hovered square: under the cursor, or under the crosshair while looking around
+        double cursorX = SCR_WIDTH / 2.0, cursorY = SCR_HEIGHT / 2.0;
+        if (not hideCursor)
+            glfwGetCursorPos(window, &cursorX, &cursorY);
+        glm::vec2 ndc(2.0f * (float) cursorX / (float) SCR_WIDTH - 1.0f, 1.0f - 2.0f * (float) cursorY / (float) SCR_HEIGHT);
+        inverseViewProjection = glm::inverse(projection * view);
+        glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+        glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+        glm::vec3 rayOrigin = glm::vec3(nearPoint) / nearPoint.w;
+        auto pickStart = std::chrono::steady_clock::now();
+        if (!pickSquare(rayOrigin, glm::vec3(farPoint) / farPoint.w - rayOrigin, hoveredRow, hoveredCol))
+            hoveredRow = 0;
+        pickMicroseconds = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - pickStart).count();
+        vector <SceneInstance> &sceneInstances = scene.instances;
+        classify_instances(sceneInstances, camera.Position, FADE_DISTANCE);
+        frustumCuller.set_instances(sceneInstances);
+
+        // 0. pick the stale cube faces to refresh this frame, most important first
+        // ------------------------------------------------------------------------
+        auto shadowStart = std::chrono::steady_clock::now();
+        shadowScheduler.facesPerFrame = shadowFacesPerFrame;
+        shadowScheduler.schedule(shadowMaps, lightPositions, projection * view, shadowTechnique, faceUpdates);
+        FrameVector<unsigned int> blurMasks(shadowMaps.size(), 0u, frameArena);
+        shadowFacesUpdated = 0;
+        shadowCullStats = CullStats();
+        for(auto &update : faceUpdates) {
+            if (shadowFacesUpdated > 0 && std::chrono::duration<float>(std::chrono::steady_clock::now() - shadowStart).count() > shadowScheduler.timeBudget)
+                break;
+            ShadowMap &shadowMap = shadowMaps[update.map];
+            if (blurMasks[update.map] & (1u << update.face))
+                continue;
+            uint64_t setupStart = CpuProfiler::now();
+            glm::vec3 lightPosition = lightPositions[update.map];
+            shadow_transforms(lightPosition, shadowProj, shadowTransforms);
+
+            unsigned int scheduledMask = 0;
+            for(auto &other : faceUpdates)
+                if (other.map == update.map)
+                    scheduledMask |= 1u << other.face;
+
+            // 1. render scene to depth cube map, all six faces at once through the
+            //    geometry shader if they are all due, otherwise just this face
+            // ---------------------------------------------------------------------
+            gpuProfiler.begin(indexed_name("shadow {}", update.map));
+            GLsizei size = (GLsizei) (shadowTechnique == SHADOW_TECHNIQUE_ESM ? shadowMap.momentSize : shadowMap.size);
+            glViewport(0, 0, size, size);
+            glDisable(GL_BLEND);
+            Shader &shader = scheduledMask == 0x3f ? depthShader : depthFaceShader;
+            if (scheduledMask == 0x3f)
+                glBindFramebuffer(GL_FRAMEBUFFER, shadowTechnique == SHADOW_TECHNIQUE_ESM ? shadowMap.momentFBO : shadowMap.depthFBO);
+            else
+                shadowMap.bind_face(update.face);
+            if (shadowTechnique == SHADOW_TECHNIQUE_ESM) {
+                const float farMoment[] = {std::exp(ESM_EXPONENT), 0.0f, 0.0f, 0.0f};
+                glClearBufferfv(GL_COLOR, 0, farMoment);
+            }
             glClear(GL_DEPTH_BUFFER_BIT);
-            depthShader.use();
-            for (unsigned int j = 0; j < 6; ++j) {
-                depthShader.setMat4(fmt::format("shadowMatrices[{}]", j), shadowTransforms[j]);
+            shader.use();
+            if (scheduledMask == 0x3f) {
+                for (unsigned int j = 0; j < 6; ++j) {
+                    shader.setMat4(indexed_name("shadowMatrices[{}]", j), shadowTransforms[j]);
+                }
+            } else {
+                shader.setMat4("shadowMatrix", shadowTransforms[update.face]);
             }
-            depthShader.setFloat("far_plane", far_plane);
-            depthShader.setVec3("lightPos", spotLights[i].position);
-            renderScene(depthShader);
+            shader.setFloat("far_plane", far_plane);
+            shader.setFloat("esmExponent", ESM_EXPONENT);
+            shader.setVec3("lightPos", lightPosition);
+            // a cube face sees its frustum, all six together the light's range, both asked of the scene BVH first
+            if (!frustumCulling)
+                shadowCullStats.add(frustumCuller.keep_all());
+            else if (scheduledMask == 0x3f)
+                shadowCullStats.add(frustumCuller.cull_sphere(lightPosition, far_plane, scene));
+            else
+                shadowCullStats.add(frustumCuller.cull(Frustum(shadowTransforms[update.face]), scene));
+            cpuProfiler.record("shadow setup", setupStart, CpuProfiler::now());
+            renderScene(sceneInstances, frustumCuller, shader, true);
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glEnable(GL_BLEND);
+            gpuProfiler.end();
+
+            unsigned int renderedMask = scheduledMask == 0x3f ? 0x3f : 1u << update.face;
+            for (int face = 0; face < 6; face++) {
+                if (renderedMask & (1u << face)) {
+                    shadowMap.mark_face_updated(face, lightPosition);
+                    shadowFacesUpdated++;
+                }
+            }
+            blurMasks[update.map] |= renderedMask;
+        }
+
+        // 2. prefilter the updated moments once, shading then needs a single fetch
+        // -------------------------------------------------------------------------
+        if (shadowTechnique == SHADOW_TECHNIQUE_ESM) {
+            gpuProfiler.begin("shadow blur");
+            for(unsigned int i = 0; i < shadowMaps.size(); i++) {
+                if (blurMasks[i])
+                    momentBlur.apply(shadowMaps[i], blurShader, blurMasks[i]);
+            }
+            gpuProfiler.end();
         }
 
-        // 2. render scene as normal
+        // 3. render scene as normal
         // -------------------------
         glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        objectShader.use();
-        objectShader.setFloat("far_plane", far_plane);
-        objectShader.setVec3("cameraPos", camera.Position);
-        for(unsigned int i = 0; i < pointLights.size()+spotLights.size(); i++) {
-            objectShader.setInt(fmt::format("depthMaps[{}]", i), 15+(int)i);
-            glActiveTexture(GL_TEXTURE15+i);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemaps[i]);
+        cameraCullStats = frustumCulling ? frustumCuller.cull(Frustum(projection * view), scene) : frustumCuller.keep_all();
+        if (renderPipeline == RENDER_PIPELINE_DEFERRED) {
+            // 3a. opaque surfaces into the G-buffer
+            // -------------------------------------
+            gpuProfiler.begin("g-buffer");
+            gBuffer.resize(SCR_WIDTH, SCR_HEIGHT);
+            glBindFramebuffer(GL_FRAMEBUFFER, gBuffer.FBO);
+            glDisable(GL_BLEND);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            gBufferShader.begin_frame(0, configureGeometry);
+            renderOpaque(sceneInstances, frustumCuller, gBufferShader);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glEnable(GL_BLEND);
+            gpuProfiler.end();
+
+            // 3b. shadowed lights, every pixel shaded once; also copies the G-buffer depth
+            // ------------------------------------------------------------------------------
+            gpuProfiler.begin("deferred lighting");
+            glBindVertexArray(emptyVAO);
+            glDepthFunc(GL_ALWAYS);
+            deferredLightShader.begin_frame(lightingKey(), configureDeferredLighting);
+            deferredLightShader.use();
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            // 3c. event lights, added where the scene lies behind the front of their range
+            // ------------------------------------------------------------------------------
+            if (eventLightCount > 0) {
+                glDepthFunc(GL_LEQUAL);
+                glDepthMask(GL_FALSE);
+                glBlendFunc(GL_ONE, GL_ONE);
+                deferredEventShader.use();
+                lightClusters.bind(deferredEventShader, 10);
+                gBuffer.bind_textures(deferredEventShader, 0);
+                deferredEventShader.setMat4("inverseViewProjection", inverseViewProjection);
+                deferredEventShader.setMat4("projection", projection);
+                deferredEventShader.setMat4("view", view);
+                deferredEventShader.setFloat("cameraNear", CAMERA_NEAR);
+                deferredEventShader.setVec3("viewPosition", camera.Position);
+                deferredEventShader.setFloat("material.shininess", 32.0f);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, eventLightCount);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                glDepthMask(GL_TRUE);
+            }
+            glDepthFunc(GL_LESS);
+            glBindVertexArray(0);
+            gpuProfiler.end();
         }
 
-        for(unsigned int i = 0; i < pointLights.size(); i++) {
-            objectShader.setVec3 (fmt::format("pointLights[{}].position" , i), pointLights[i].position);
-            objectShader.setVec3 (fmt::format("pointLights[{}].ambient"  , i), pointLights[i].ambient);
-            objectShader.setVec3 (fmt::format("pointLights[{}].diffuse"  , i), pointLights[i].diffuse);
-            objectShader.setVec3 (fmt::format("pointLights[{}].specular" , i), pointLights[i].specular);
-            objectShader.setFloat(fmt::format("pointLights[{}].constant" , i), pointLights[i].constant);
-            objectShader.setFloat(fmt::format("pointLights[{}].linear"   , i), pointLights[i].linear);
-            objectShader.setFloat(fmt::format("pointLights[{}].quadratic", i), pointLights[i].quadratic);
-            objectShader.setBool (fmt::format("pointLights[{}].enabled"  , i), pointLights[i].enabled);
+        // 3d. optional depth prepass for the forward pipeline: lay down the nearest
+        //     opaque depth first so the lighting pass shades every sample once.
+        //     Both leave out the faded fragments next to the camera, so lit
+        //     fragments can test GL_EQUAL. Occlusion culling tests the instances
+        //     against the prepass depth, so it needs the prepass
+        // ---------------------------------------------------------------------------
+        frameIndex++;
+        bool prepass = renderPipeline == RENDER_PIPELINE_FORWARD && (measureOverdraw ? frameIndex % 2 == 1 : depthPrepass || occlusionCulling);
+        bool occlusionTested = prepass && occlusionCulling;
+        if (prepass) {
+            gpuProfiler.begin("depth prepass");
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            depthPrepassShader.begin_frame(0, configureGeometry);
+            renderOpaque(sceneInstances, frustumCuller, depthPrepassShader);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            gpuProfiler.end();
+            if (occlusionTested) {
+                gpuProfiler.begin("occlusion culling");
+                occlusionCuller.resize(SCR_WIDTH, SCR_HEIGHT);
+                occlusionCuller.build(hiZReduceShader, emptyVAO);
+                occlusionCuller.test(sceneInstances, frustumCuller, projection * view, hiZTestShader, emptyVAO);
+                gpuProfiler.end();
+                if (occlusionCheck) {
+                    AllowAllocations allow; // query objects on the first frame
+                    occlusionCheck->run(sceneInstances, occlusionCuller, [&](unsigned int i) {
+                        const SceneInstance &instance = sceneInstances[i];
+                        Shader &shader = depthPrepassShader.use(instance.translucent ? SHADER_FEATURE_FADE | SHADER_FEATURE_UNFADED_ONLY : 0u);
+                        instance.draw(shader, false, frustumCuller.mesh_visibility(i));
+                    });
+                }
+            }
+            glDepthFunc(GL_EQUAL);
         }
 
-        for(unsigned int i = 0; i < spotLights.size(); i++) {
-            objectShader.setVec3 (fmt::format("spotLights[{}].position"   , i), spotLights[i].position);
-            objectShader.setVec3 (fmt::format("spotLights[{}].direction"  , i), spotLights[i].direction);
-            objectShader.setVec3 (fmt::format("spotLights[{}].ambient"    , i), spotLights[i].ambient);
-            objectShader.setVec3 (fmt::format("spotLights[{}].diffuse"    , i), spotLights[i].diffuse);
-            objectShader.setVec3 (fmt::format("spotLights[{}].specular"   , i), spotLights[i].specular);
-            objectShader.setFloat(fmt::format("spotLights[{}].constant"   , i), spotLights[i].constant);
-            objectShader.setFloat(fmt::format("spotLights[{}].linear"     , i), spotLights[i].linear);
-            objectShader.setFloat(fmt::format("spotLights[{}].quadratic"  , i), spotLights[i].quadratic);
-            objectShader.setFloat(fmt::format("spotLights[{}].cutOff"     , i), spotLights[i].cutOff);
-            objectShader.setFloat(fmt::format("spotLights[{}].outerCutOff", i), spotLights[i].outerCutOff);
-            objectShader.setBool (fmt::format("spotLights[{}].enabled"    , i), spotLights[i].enabled);
+        // 3e. forward shading of the opaque fragments; the deferred pipeline
+        //     already shaded them
+        // ---------------------------------------------------------------------------
+        uint32_t frameFeatures = 0;
+        if (eventLightCount > 0)
+            frameFeatures |= SHADER_FEATURE_EVENT_LIGHTS;
+        if (eventLightCount > 0 && clusteredLighting)
+            frameFeatures |= SHADER_FEATURE_CLUSTERED_LIGHTS;
+        if (cullLights)
+            frameFeatures |= SHADER_FEATURE_LIGHT_LISTS;
+        lightCuller.begin_frame(pointLights, spotLights, scene);
+        objectShader.begin_frame(lightingKey() | frameFeatures, configureForward);
+        LightCuller *culler = cullLights ? &lightCuller : nullptr;
+        if (renderPipeline == RENDER_PIPELINE_FORWARD) {
+            if (measureOverdraw)
+                samplesQueries[prepass ? 1 : 0].begin();
+            // opaque fragments write alpha 1, blending would only cost bandwidth
+            gpuProfiler.begin("scene");
+            glDisable(GL_BLEND);
+            renderOpaque(sceneInstances, frustumCuller, objectShader, culler, occlusionTested ? &occlusionCuller : nullptr);
+            glEnable(GL_BLEND);
+            gpuProfiler.end();
+            if (measureOverdraw)
+                samplesQueries[prepass ? 1 : 0].end();
         }
+        glDepthFunc(GL_LESS);
+
+        // 3f. faded fragments next to the camera, weighted blended in any order
+        //     against the opaque depth, then composited over the opaque scene
+        // ---------------------------------------------------------------------------
+        bool translucent = false;
+        for(unsigned int i = 0; i < sceneInstances.size(); i++)
+            translucent = translucent || (sceneInstances[i].translucent && frustumCuller.instance_visible(i));
+        if (translucent) {
+            gpuProfiler.begin("translucent");
+            oitBuffer.resize(SCR_WIDTH, SCR_HEIGHT);
+            oitBuffer.begin();
+            glDepthMask(GL_FALSE);
+            glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+            renderTranslucent(sceneInstances, frustumCuller, objectShader, culler);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        objectShader.setVec3 ("viewPosition"        , camera.Position);
-        objectShader.setFloat("material.shininess"  , 32.0f);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glDepthFunc(GL_ALWAYS);
+            oitCompositeShader.use();
+            oitBuffer.bind_textures(oitCompositeShader, 0);
+            glBindVertexArray(emptyVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glBindVertexArray(0);
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+            gpuProfiler.end();
+        }
 
-        glm::mat4 projection = glm::perspective(
-            glm::radians(camera.Zoom),
-            (float) SCR_WIDTH / (float) SCR_HEIGHT,
-            0.1f,
-            100.0f
-        );
-        glm::mat4 view = camera.GetViewMatrix();
+        if (measureOverdraw) {
+            for (int i = 0; i < 2; i++) {
+                GLuint64 samples;
+                while (samplesQueries[i].result(samples)) {
+                    shadedSamples[i] += (double) samples;
+                    measuredFrames[i]++;
+                }
+            }
+            if (currentFrame - overdrawReportTime > 1.0f && measuredFrames[0] > 0 && measuredFrames[1] > 0) {
+                AllowAllocations allow;
+                double samplesPerFrame = (double) SCR_WIDTH * SCR_HEIGHT * glm::max(framebufferSamples, 1);
+                double without = shadedSamples[0] / measuredFrames[0] / samplesPerFrame;
+                double with = shadedSamples[1] / measuredFrames[1] / samplesPerFrame;
+                std::cout << fmt::format("Shaded samples per framebuffer sample: {:.2f} without depth prepass, {:.2f} with ({:.0f}% fewer)",
+                                         without, with, without > 0.0 ? 100.0 * (1.0 - with / without) : 0.0) << std::endl;
+                shadedSamples[0] = shadedSamples[1] = 0.0;
+                measuredFrames[0] = measuredFrames[1] = 0;
+                overdrawReportTime = currentFrame;
+            }
+        }
 
-        objectShader.setMat4("projection", projection);
-        objectShader.setMat4("view", view);
-        renderScene(objectShader);
+        if (gpuProfiler.enabled && gpuProfiler.statistics && currentFrame - statisticsReportTime > 1.0f) {
+            AllowAllocations allow;
+            gpuProfiler.write_statistics(std::cout, (double) SCR_WIDTH * SCR_HEIGHT);
+            statisticsReportTime = currentFrame;
+        }
+
+        // 4. overdraw view: the fragments the scene shades per pixel, counted with
+        //    the depth test of the opaque pass in the chosen draw order, shown as
+        //    a heatmap in place of the shaded scene
+        // ---------------------------------------------------------------------------
+        if (overdrawView != OVERDRAW_VIEW_OFF) {
+            gpuProfiler.begin("overdraw view");
+            overdrawBuffer.resize(SCR_WIDTH, SCR_HEIGHT);
+            overdrawBuffer.begin();
+            glBlendFunc(GL_ONE, GL_ONE);
+            overdrawCountShader.use();
+            overdrawCountShader.setMat4("projection", projection);
+            overdrawCountShader.setMat4("view", view);
+            FrameVector<std::pair<float, unsigned int>> drawList(frameArena);
+            front_to_back(sceneInstances, frustumCuller, camera.Position, drawList);
+            if (overdrawView == OVERDRAW_VIEW_BACK_TO_FRONT)
+                std::reverse(drawList.begin(), drawList.end());
+            for(auto &draw : drawList)
+                sceneInstances[draw.second].draw(overdrawCountShader, false, frustumCuller.mesh_visibility(draw.second));
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+            glDisable(GL_BLEND);
+            glDepthFunc(GL_ALWAYS);
+            glDepthMask(GL_FALSE);
+            overdrawHeatmapShader.use();
+            overdrawBuffer.bind_texture(overdrawHeatmapShader, 0);
+            glBindVertexArray(emptyVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glBindVertexArray(0);
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glEnable(GL_BLEND);
+            gpuProfiler.end();
+        }
+
+        gpuProfiler.begin("light gizmos");
         if (not hideLights) {
             lightShader.use();
             lightShader.setMat4("projection", projection);
             lightShader.setMat4("view", view);
             renderLights(lightShader);
         }
+        if (hoveredRow) {
+            lightShader.use();
+            lightShader.setMat4("projection", projection);
+            lightShader.setMat4("view", view);
+            renderHighlight(lightShader, hoveredRow, hoveredCol);
+        }
+        gpuProfiler.end();
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            CpuZone zone(cpuProfiler, "glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
+        {
+            CpuZone zone(cpuProfiler, "glfwPollEvents");
+            glfwPollEvents();
+        }
+        frameAllocations = thread_allocations().since(frameStart);
+        totalFrameAllocations.allocations += frameAllocations.allocations;
+        totalFrameAllocations.bytes += frameAllocations.bytes;
+    }
+    thread_allocation_check().forbidden = false;
+
+    if (frameBenchmark) {
+        gpuProfiler.finish();
+        GLint samples = 0;
+        glGetIntegerv(GL_SAMPLES, &samples);
+        std::ofstream out(benchmarkOutput);
+        frameBenchmark->write_json(out, {
+            {"renderer", json_string((const char *) glGetString(GL_RENDERER))},
+            {"width", fmt::format("{}", SCR_WIDTH)},
+            {"height", fmt::format("{}", SCR_HEIGHT)},
+            {"samples", fmt::format("{}", samples)},
+            {"pipeline", json_string(render_pipeline_name(renderPipeline))},
+            {"event_lights", fmt::format("{}", eventLightCount)},
+            {"shadows", json_string(shadow_technique_name(shadowTechnique))},
+            {"shadow_filter", json_string(shadow_filter_name(shadowFilter))},
+            {"shadow_faces_per_frame", fmt::format("{}", shadowFacesPerFrame)}
+        }, cpuProfiler.zone_totals(frameBenchmark->measure_start()), gpuProfiler, {
+            {"shadow_maps", shadowAtlas.bytes_in_use(shadowMaps)},
+            {"g_buffer", renderPipeline == RENDER_PIPELINE_DEFERRED ? gBuffer.bytes() : 0},
+            {"oit_buffer", oitBuffer.bytes()},
+            {"overdraw_buffer", overdrawBuffer.bytes()},
+            {"hi_z", occlusionCulling ? occlusionCuller.bytes() : 0},
+            {"frame_arena", frameArena.capacity()},
+            {"frame_arena_peak", frameArena.peak()}
+        });
+        std::cout << "Benchmark written to " << benchmarkOutput << std::endl;
+    }
+    int status = 0;
+    if (occlusionCheck) {
+        std::cout << fmt::format("Occlusion check over {} frames: {} instances visible without occlusion culling, {} kept with it, {} wrongly occluded",
+                                 occlusionCheck->frames, occlusionCheck->visibleWithout, occlusionCheck->visibleWith,
+                                 occlusionCheck->wronglyOccluded) << std::endl;
+        status = occlusionCheck->frames == 0 || occlusionCheck->wronglyOccluded > 0 ? 1 : 0;
+    }
+    // the sweeps' CSV goes to the standard output as well
+    if (!lightSweep && !scalingSweep) {
+        frameStats.write_summary(std::cout);
+        writeAllocationSummary(std::cout, loopStart);
+    }
+    if (!cpuTracePath.empty()) {
+        std::ofstream trace(cpuTracePath);
+        cpuProfiler.write_chrome_trace(trace);
     }
-
     glfwTerminate();
-    return 0;
+    return status;
 }
 
 void loadPieceModels() {
@@ -338,42 +1102,242 @@ void loadPieceModels() {
             "pawn_black", "rook_black", "knight_black", "bishop_black", "king_black", "queen_black"
     };
     for(const auto& name : piece_names) {
+        CpuZone zone(cpuProfiler, "load piece");
         pieceModels[name] = std::make_shared<Model>(path + name + "/modelf.obj");
+        pieceModels[name]->GenerateShadowProxy(SHADOW_PROXY_ERROR);
+        std::cout << fmt::format("Shadow proxy for {}: {} -> {} triangles", name,
+                                 pieceModels[name]->shadowProxy.sourceTriangles,
+                                 pieceModels[name]->shadowProxy.indexCount / 3) << std::endl;
     }
 }
 
-void renderScene(Shader &shader) {
-    { // render board
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.06f));
-        model = glm::scale(model, glm::vec3(0.183f));
-        shader.setMat4("model", model);
-        model_board->Draw(shader);
-    }
+glm::mat4 boardTransform(glm::vec3 offset) {
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::translate(model, offset + glm::vec3(0.0f, 0.0f, 0.06f));
+    model = glm::scale(model, glm::vec3(0.183f));
+    return model;
+}
+
+glm::mat4 pieceTransform(int row, char col, const string &piece_name, glm::vec3 offset) {
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::translate(model, offset + Board::get_position(row, col));
+    if(piece_name == "knight_white")
+        model = glm::translate(model, glm::vec3(0.0, +0.16, 0.0));
+    if(piece_name == "knight_black")
+        model = glm::translate(model, glm::vec3(0.0, -0.16, 0.0));
+    model = glm::scale(model, glm::vec3(0.183f));
+    return model;
+}
 
-    { // render chess pieces
-        std::vector < std::tuple<float, int, char> > pieces;
-        for(int row = 1; row <= 8; row++) {
-            for (char col = 'a'; col <= 'h'; col++) {
-                pieces.emplace_back(glm::length(board.get_position(row, col) - camera.Position), row, col);
+// Brings the board's instances up to date: tag boardIndex * 65 is the board
+// itself, the next 64 are its squares. Only the squares that changed touch the
+// scene, the rest of its BVH stays as it is. A piece that left one square for
+// another keeps its instance, which only moves and refits the BVH above it.
+void syncScene(Scene &scene, Board &board, int boardIndex, glm::vec3 offset) {
+    vector <int> squareInstances(65, -1);
+    for(unsigned int i = 0; i < scene.instances.size(); i++) {
+        int tag = scene.instances[i].tag;
+        if (tag >= 0 && tag / 65 == boardIndex)
+            squareInstances[tag % 65] = (int) i;
+    }
+    if (squareInstances[0] < 0)
+        scene.add(model_board.get(), boardTransform(offset), boardIndex * 65);
+
+    vector <unsigned int> removed;
+    vector <int> added; // squares that gained a piece
+    for(int row = 1; row <= 8; row++) {
+        for (char col = 'a'; col <= 'h'; col++) {
+            int square = 1 + (row - 1) * 8 + (col - 'a');
+            int index = squareInstances[square];
+            const string &piece_name = board.get_piece(row, col);
+            if (piece_name.empty()) {
+                if (index >= 0)
+                    removed.push_back((unsigned int) index);
+                continue;
             }
+            Model *model = pieceModels[piece_name].get();
+            if (index < 0)
+                added.push_back(square);
+            else if (scene.instances[index].model != model)
+                scene.set((unsigned int) index, model, pieceTransform(row, col, piece_name, offset));
         }
-        sort(pieces.rbegin(), pieces.rend());
-        for(auto piece : pieces) {
-            string piece_name = board.get_piece(std::get<1>(piece), std::get<2>(piece));
-            if(!piece_name.empty()) {
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, board.get_position(std::get<1>(piece), std::get<2>(piece)));
-                if(piece_name == "knight_white")
-                    model = glm::translate(model, glm::vec3(0.0, +0.16, 0.0));
-                if(piece_name == "knight_black")
-                    model = glm::translate(model, glm::vec3(0.0, -0.16, 0.0));
-                model = glm::scale(model, glm::vec3(0.183f));
-                shader.setMat4("model", model);
-                pieceModels[piece_name]->Draw(shader);
-            }
+    }
+    for(int square : added) {
+        int row = 1 + (square - 1) / 8;
+        char col = (char) ('a' + (square - 1) % 8);
+        const string &piece_name = board.get_piece(row, col);
+        Model *model = pieceModels[piece_name].get();
+        glm::mat4 transform = pieceTransform(row, col, piece_name, offset);
+        auto moved = std::find_if(removed.begin(), removed.end(), [&](unsigned int index) { return scene.instances[index].model == model; });
+        if (moved == removed.end()) {
+            scene.add(model, transform, boardIndex * 65 + square);
+            continue;
+        }
+        scene.set(*moved, model, transform);
+        scene.instances[*moved].tag = boardIndex * 65 + square;
+        removed.erase(moved);
+    }
+    // highest first, each removal moves the last instance into the gap
+    std::sort(removed.rbegin(), removed.rend());
+    for(unsigned int index : removed)
+        scene.remove(index);
+}
+
+// Square hit by a ray: the one under the nearest piece it hits, or the one
+// under the point where it hits the board.
+bool pickSquare(glm::vec3 origin, glm::vec3 direction, int &row, char &col) {
+    PickHit hit;
+    if (!picker.raycast(scene, origin, direction, CAMERA_FAR, hit))
+        return false;
+    int tag = scene.instances[hit.instance].tag;
+    if (tag < 0)
+        return false;
+    int square = tag % 65 - 1;
+    if (square >= 0) {
+        row = square / 8 + 1;
+        col = (char) ('a' + square % 8);
+        return true;
+    }
+    // squares are unit sized, a1 centered at (-3.5, -3.5), see Board::get_position
+    int x = (int) std::floor(hit.position.x + 4.0f);
+    int y = (int) std::floor(hit.position.y + 4.0f);
+    if (x < 0 || x > 7 || y < 0 || y > 7)
+        return false;
+    row = y + 1;
+    col = (char) ('a' + x);
+    return true;
+}
+
+// sets an enum from its name, spaces left out, e.g. poisson16
+template<typename Enum>
+bool parseSetting(const string &value, Enum count, const char *(*name)(Enum), Enum &setting) {
+    for (int i = 0; i < (int) count; i++) {
+        string candidate = name((Enum) i);
+        candidate.erase(std::remove(candidate.begin(), candidate.end(), ' '), candidate.end());
+        if (candidate == value) {
+            setting = (Enum) i;
+            return true;
         }
     }
+    return false;
+}
+
+// a whole decimal number and nothing else, unlike atoi
+bool parseInt(const string &value, int &result) {
+    char *end = nullptr;
+    errno = 0;
+    long number = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || errno == ERANGE || number < INT_MIN || number > INT_MAX)
+        return false;
+    result = (int) number;
+    return true;
+}
+
+// boards on a square grid around the origin, 10 units apart
+glm::vec3 boardOffset(int boardIndex, int boards) {
+    int side = (int) std::ceil(std::sqrt((float) boards));
+    return 10.0f * glm::vec3((float) (boardIndex % side) - (float) (side - 1) / 2.0f,
+                             (float) (boardIndex / side) - (float) (side - 1) / 2.0f, 0.0f);
+}
+
+void setupScalingCell(const ScalingCell &cell, ShadowAtlas &shadowAtlas) {
+    scene.clear();
+    for(int i = 0; i < cell.boards; i++)
+        syncScene(scene, board, i, boardOffset(i, cell.boards));
+    eventLightCount = cell.lights;
+    shadowAtlas.minSize = shadowAtlas.maxSize = cell.shadowSize;
+    shadowAtlas.replan();
+    shadowFilter = cell.shadowFilter;
+    frustumCulling = cell.culling;
+    // the starting view, backed off until the whole grid fits
+    int side = (int) std::ceil(std::sqrt((float) cell.boards));
+    camera = Camera(glm::vec3(0.0f, -9.0f, 9.0f) * (float) side);
+}
+
+void runSceneBenchmark() {
+    for(unsigned int boards : {1u, 16u, 256u}) {
+        Scene benchmarkScene;
+        Board benchmarkBoard;
+        for(unsigned int i = 0; i < boards; i++)
+            syncScene(benchmarkScene, benchmarkBoard, (int) i, boardOffset((int) i, (int) boards));
+        int side = (int) std::ceil(std::sqrt((float) boards));
+        glm::vec3 extent = glm::vec3(5.0f * (float) side, 5.0f * (float) side, 0.0f);
+        write_scene_benchmark(benchmarkScene, boards, -extent, extent, std::cout, boards == 1);
+    }
+}
+
+// in scene order: it draws the shadow faces, depth only, where early depth
+// testing saves little and a sort for every face updated would add up
+void renderScene(const vector<SceneInstance> &instances, const FrustumCuller &culler, Shader &shader, bool shadowPass) {
+    CpuZone zone(cpuProfiler, "renderScene");
+    for(unsigned int i = 0; i < instances.size(); i++) {
+        if (culler.instance_visible(i))
+            instances[i].draw(shader, shadowPass, culler.mesh_visibility(i));
+    }
+}
+
+// sets the draw's light list, see LightCuller
+void setDrawLights(Shader &shader, const LightCuller *lightCuller, unsigned int instance) {
+    if (!lightCuller)
+        return;
+    int count = lightCuller->count(instance);
+    glUniform1i(shader.cachedLocation("drawLightCount"), count);
+    glUniform1iv(shader.cachedLocation("drawLights"), count, lightCuller->slots(instance));
+}
+
+void renderOpaque(const vector<SceneInstance> &instances, const FrustumCuller &culler, ShaderVariants &variants, LightCuller *lightCuller,
+                  const OcclusionCuller *occlusionCuller) {
+    CpuZone zone(cpuProfiler, "renderOpaque");
+    FrameVector<std::pair<float, unsigned int>> drawList(frameArena);
+    front_to_back(instances, culler, camera.Position, drawList);
+    // translucent instances leave their faded fragments to renderTranslucent
+    for(auto &draw : drawList) {
+        unsigned int i = draw.second;
+        const SceneInstance &instance = instances[i];
+        Shader &shader = variants.use(instance.translucent ? SHADER_FEATURE_FADE | SHADER_FEATURE_UNFADED_ONLY : 0u);
+        setDrawLights(shader, lightCuller, i);
+        if (occlusionCuller)
+            occlusionCuller->begin_draw(i);
+        instance.draw(shader, false, culler.mesh_visibility(i));
+        if (occlusionCuller)
+            occlusionCuller->end_draw(i);
+    }
+}
+
+void renderTranslucent(const vector<SceneInstance> &instances, const FrustumCuller &culler, ShaderVariants &variants, LightCuller *lightCuller) {
+    CpuZone zone(cpuProfiler, "renderTranslucent");
+    // weighted blended, see OITBuffer, so the order doesn't matter
+    for(unsigned int i = 0; i < instances.size(); i++) {
+        if (!instances[i].translucent || !culler.instance_visible(i))
+            continue;
+        const SceneInstance &instance = instances[i];
+        Shader &shader = variants.use(SHADER_FEATURE_FADE | SHADER_FEATURE_FADED_ONLY | SHADER_FEATURE_OIT);
+        setDrawLights(shader, lightCuller, i);
+        instance.draw(shader, false, culler.mesh_visibility(i));
+    }
+}
+
+void shadowRequests(vector<ShadowRequest> &requests) {
+    // everything that can receive a shadow lies on or just above the board
+    const glm::vec3 sceneCenter(0.0f);
+    const float sceneRadius = 6.0f;
+
+    requests.clear();
+    for(auto &pointLight : pointLights) {
+        float radius = glm::min(sceneRadius, pointLight.range());
+        requests.push_back({pointLight.position, sceneCenter, radius});
+    }
+    for(auto &spotLight : spotLights) {
+        // footprint of the outer cone on the board plane
+        glm::vec3 center = sceneCenter;
+        float radius = sceneRadius;
+        if (spotLight.direction.z < 0.0f) {
+            float distance = -spotLight.position.z / spotLight.direction.z;
+            center = spotLight.position + distance * spotLight.direction;
+            radius = glm::min(sceneRadius, distance * std::tan(std::acos(spotLight.outerCutOff)));
+        }
+        requests.push_back({spotLight.position, center, radius});
+    }
 }
 
 void renderLights(Shader &shader) {
@@ -402,6 +1366,148 @@ void renderLights(Shader &shader) {
     }
 }
 
+void renderHighlight(Shader &shader, int row, char col) {
+    // a thin slab over the square, whatever the size of the cube model
+    glm::vec3 size = model_cube->boundsMax - model_cube->boundsMin;
+    glm::vec3 center = 0.5f * (model_cube->boundsMin + model_cube->boundsMax);
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::translate(model, Board::get_position(row, col) + glm::vec3(0.0f, 0.0f, 0.01f));
+    model = glm::scale(model, glm::vec3(0.95f, 0.95f, 0.01f) / size);
+    model = glm::translate(model, -center);
+    shader.setMat4("model", model);
+    shader.setVec3("lightColor", glm::vec3(0.2f, 0.8f, 1.0f));
+    model_cube->Draw(shader);
+}
+
+void generateEventLights(int count) {
+    // fixed seed, so every run and every benchmark sees the same lights
+    std::mt19937 random(2023);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    eventLights.clear();
+    for(int i = 0; i < count; i++) {
+        PointLight light;
+        light.position = glm::vec3(uniform(random) * 8.0f - 4.0f, uniform(random) * 8.0f - 4.0f, 0.4f + uniform(random) * 1.2f);
+        // saturated hue, short reach
+        float hue = uniform(random) * 6.0f;
+        glm::vec3 color = glm::clamp(glm::vec3(std::abs(hue - 3.0f) - 1.0f, 2.0f - std::abs(hue - 2.0f), 2.0f - std::abs(hue - 4.0f)), 0.0f, 1.0f);
+        light.set_light(color * 0.3f);
+        light.ambient = glm::vec3(0.0f);
+        light.linear = 1.4f;
+        light.quadratic = 7.2f;
+        light.enabled = true;
+        eventLights.push_back(light);
+    }
+}
+
+void animateEventLights(float time) {
+    // every light circles its own spot on the board
+    for(unsigned int i = 0; i < eventLights.size(); i++) {
+        float phase = (float) i * 2.39996f; // golden angle, so neighbours drift apart
+        float speed = 0.8f + 0.4f * std::sin(phase);
+        eventLights[i].position.x += std::cos(time * speed + phase) * deltaTime * 0.5f;
+        eventLights[i].position.y += std::sin(time * speed + phase) * deltaTime * 0.5f;
+    }
+}
+
+ShaderKey lightingKey() {
+    // same order as setLightUniforms: enabled point lights, then enabled spotlights
+    unsigned int pointCount = 0, spotCount = 0;
+    uint32_t shadowMask = 0;
+    for(auto &pointLight : pointLights) {
+        if (!pointLight.enabled)
+            continue;
+        if (pointLight.castShadows)
+            shadowMask |= 1u << pointCount;
+        pointCount++;
+    }
+    for(auto &spotLight : spotLights) {
+        if (!spotLight.enabled)
+            continue;
+        if (spotLight.castShadows)
+            shadowMask |= 1u << (pointCount + spotCount);
+        spotCount++;
+    }
+    return shader_key(0, pointCount, spotCount, shadowMask, shadowFilter, shadowTechnique);
+}
+
+void setLightUniforms(Shader &shader, const vector<ShadowMap> &shadowMaps, float farPlane) {
+    CpuZone zone(cpuProfiler, "uniform upload");
+    shader.setFloat("far_plane", farPlane);
+    shader.setFloat("esmExponent", ESM_EXPONENT);
+
+    // only enabled lights are uploaded, slot i samples the shadow map of the i-th one;
+    // kept from call to call, so it doesn't allocate
+    static vector <unsigned int> mapIndices;
+    mapIndices.clear();
+    unsigned int i = 0;
+    for(unsigned int j = 0; j < pointLights.size(); j++) {
+        if (!pointLights[j].enabled)
+            continue;
+        shader.setVec3 (indexed_name("pointLights[{}].position" , i), pointLights[j].position);
+        shader.setVec3 (indexed_name("pointLights[{}].ambient"  , i), pointLights[j].ambient);
+        shader.setVec3 (indexed_name("pointLights[{}].diffuse"  , i), pointLights[j].diffuse);
+        shader.setVec3 (indexed_name("pointLights[{}].specular" , i), pointLights[j].specular);
+        shader.setFloat(indexed_name("pointLights[{}].constant" , i), pointLights[j].constant);
+        shader.setFloat(indexed_name("pointLights[{}].linear"   , i), pointLights[j].linear);
+        shader.setFloat(indexed_name("pointLights[{}].quadratic", i), pointLights[j].quadratic);
+        mapIndices.push_back(j);
+        i++;
+    }
+
+    i = 0;
+    for(unsigned int j = 0; j < spotLights.size(); j++) {
+        if (!spotLights[j].enabled)
+            continue;
+        shader.setVec3 (indexed_name("spotLights[{}].position"   , i), spotLights[j].position);
+        shader.setVec3 (indexed_name("spotLights[{}].direction"  , i), spotLights[j].direction);
+        shader.setVec3 (indexed_name("spotLights[{}].ambient"    , i), spotLights[j].ambient);
+        shader.setVec3 (indexed_name("spotLights[{}].diffuse"    , i), spotLights[j].diffuse);
+        shader.setVec3 (indexed_name("spotLights[{}].specular"   , i), spotLights[j].specular);
+        shader.setFloat(indexed_name("spotLights[{}].constant"   , i), spotLights[j].constant);
+        shader.setFloat(indexed_name("spotLights[{}].linear"     , i), spotLights[j].linear);
+        shader.setFloat(indexed_name("spotLights[{}].quadratic"  , i), spotLights[j].quadratic);
+        shader.setFloat(indexed_name("spotLights[{}].cutOff"     , i), spotLights[j].cutOff);
+        shader.setFloat(indexed_name("spotLights[{}].outerCutOff", i), spotLights[j].outerCutOff);
+        mapIndices.push_back((unsigned int) pointLights.size() + j);
+        i++;
+    }
+
+    // a variant declares either depthMaps or momentMaps, the other names are ignored
+    for(unsigned int k = 0; k < mapIndices.size(); k++) {
+        const ShadowMap &shadowMap = shadowMaps[mapIndices[k]];
+        glActiveTexture(GL_TEXTURE15+k);
+        if (shadowTechnique == SHADOW_TECHNIQUE_ESM) {
+            shader.setInt(indexed_name("momentMaps[{}]", k), 15+(int)k);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMap.momentCubemap);
+        } else {
+            shader.setInt(indexed_name("depthMaps[{}]", k), 15+(int)k);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMap.depthCubemap);
+        }
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.setVec3 ("viewPosition"        , camera.Position);
+    shader.setFloat("material.shininess"  , 32.0f);
+}
+
+void writeAllocationSummary(std::ostream &out, uint64_t since) {
+    unsigned long long frames = std::max(frameStats.total_frames(), 1ull);
+    out << fmt::format("Heap allocations per frame: {:.1f} ({:.0f} bytes), {} in the last frame\n",
+                       (double) totalFrameAllocations.allocations / (double) frames,
+                       (double) totalFrameAllocations.bytes / (double) frames, frameAllocations.allocations);
+    out << fmt::format("Frame arena: {} bytes at the peak, {} reserved, {} allocations went to the heap\n",
+                       frameArena.peak(), frameArena.capacity(), frameArena.overflows);
+    // zones of the frame loop as far back as the profiler keeps them, nested zones included
+    std::map<string, CpuProfiler::ZoneTotal> zones = cpuProfiler.zone_totals(since);
+    auto frameZone = zones.find("frame");
+    double zoneFrames = frameZone != zones.end() ? (double) frameZone->second.calls : 1.0;
+    for (auto &zone : zones) {
+        if (zone.second.allocations > 0)
+            out << fmt::format("  {:<20} {:>8.1f} allocations {:>10.0f} bytes\n", zone.first,
+                               (double) zone.second.allocations / zoneFrames, (double) zone.second.allocatedBytes / zoneFrames);
+    }
+}
+
 void processInput(GLFWwindow *window) {
 
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -480,9 +1586,60 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     (void) window;
     (void) scancode;
     (void) mods;
+    // settings change between frames, e.g. the CPU trace is written from here
+    AllowAllocations allow;
 
     if (key == GLFW_KEY_H and action == GLFW_PRESS)
         hideLights = not hideLights;
     if (key == GLFW_KEY_F and action == GLFW_PRESS)
         printFps = not printFps;
+    if (key == GLFW_KEY_P and action == GLFW_PRESS)
+        shadowFilter = next_shadow_filter(shadowFilter);
+    if (key == GLFW_KEY_O and action == GLFW_PRESS)
+        shadowTechnique = next_shadow_technique(shadowTechnique);
+    if (key == GLFW_KEY_L and action == GLFW_PRESS)
+        animateLights = not animateLights;
+    if (key == GLFW_KEY_K and action == GLFW_PRESS) {
+        // cycle the per-frame cube face budget: all, 1, 2, 4, 6, 12
+        const int budgets[] = {0, 1, 2, 4, 6, 12};
+        int next = 0;
+        for (int i = 0; i < 6; i++)
+            if (budgets[i] == shadowFacesPerFrame)
+                next = (i + 1) % 6;
+        shadowFacesPerFrame = budgets[next];
+    }
+    if (key == GLFW_KEY_G and action == GLFW_PRESS)
+        renderPipeline = next_render_pipeline(renderPipeline);
+    if (key == GLFW_KEY_Z and action == GLFW_PRESS)
+        depthPrepass = not depthPrepass;
+    if (key == GLFW_KEY_M and action == GLFW_PRESS)
+        measureOverdraw = not measureOverdraw;
+    if (key == GLFW_KEY_U and action == GLFW_PRESS)
+        cullLights = not cullLights;
+    if (key == GLFW_KEY_V and action == GLFW_PRESS)
+        frustumCulling = not frustumCulling;
+    if (key == GLFW_KEY_X and action == GLFW_PRESS)
+        occlusionCulling = not occlusionCulling;
+    if (key == GLFW_KEY_T and action == GLFW_PRESS)
+        gpuProfiler.enabled = not gpuProfiler.enabled;
+    if (key == GLFW_KEY_I and action == GLFW_PRESS) {
+        if (!gpuProfiler.set_statistics(not gpuProfiler.statistics))
+            std::cout << "GL_ARB_pipeline_statistics_query is not supported" << std::endl;
+    }
+    if (key == GLFW_KEY_N and action == GLFW_PRESS) {
+        const char *names[] = {"off", "front to back", "back to front"};
+        overdrawView = (OverdrawView) ((overdrawView + 1) % 3);
+        std::cout << "Overdraw view: " << names[overdrawView] << std::endl;
+    }
+    if (key == GLFW_KEY_J and action == GLFW_PRESS) {
+        std::ofstream trace("cpu_trace.json");
+        cpuProfiler.write_chrome_trace(trace);
+        std::cout << "CPU trace written to cpu_trace.json" << std::endl;
+    }
+    if (key == GLFW_KEY_C and action == GLFW_PRESS)
+        clusteredLighting = not clusteredLighting;
+    if (key == GLFW_KEY_EQUAL and action == GLFW_PRESS)
+        eventLightCount = glm::clamp(eventLightCount * 2, 1, MAX_EVENT_LIGHTS);
+    if (key == GLFW_KEY_MINUS and action == GLFW_PRESS)
+        eventLightCount /= 2;
 }